@@ -0,0 +1,71 @@
+/**************************************************************************************
+ * Filename: replay.cpp
+ * Description: ltd-replay
+ * Replays an allocation trace recorded with `memory::recording_allocator` on
+ * several allocator compositions and reports the time per operation of each.
+ *
+ * Usage: ltd-replay <trace-file> [repetitions]
+ *
+ **************************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <ltd.h>
+
+using namespace ltd;
+
+template<size_t Lo, size_t Hi>
+using pool = memory::freelist<memory::heap_allocator, Lo, Hi, 1024>;
+
+using freelist_heap   = memory::freelist<memory::heap_allocator, 0, 256, 1024>;
+using bucketized_heap = memory::segregator<256, memory::bucketizer<pool, 0, 256, 16>, memory::heap_allocator>;
+using arena_heap      = memory::fallback_allocator<memory::arena_allocator, memory::heap_allocator>;
+using cached_heap     = memory::thread_cache_allocator<memory::heap_allocator>;
+
+template<typename A>
+void run(const char *name, const std::vector<memory::trace_record>& trace, int repetitions)
+{
+    memory::replay_result best{0, 0, 0, 0};
+
+    for (int i = 0; i < repetitions; i++) {
+        A allocator;
+        auto result = memory::replay(trace, allocator);
+
+        if (i == 0 || result.nanoseconds < best.nanoseconds)
+            best = result;
+    }
+
+    double per_operation = best.operations > 0 ? (double)best.nanoseconds / best.operations : 0.0;
+
+    printf("%-12s %12zu %10zu %12.1f %14zu\n", name, best.operations, best.failures, per_operation, best.peak_bytes);
+}
+
+auto main(int argc, char** argv) -> int
+{
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s <trace-file> [repetitions]\n", argv[0]);
+        return 1;
+    }
+
+    int repetitions = argc > 2 ? atoi(argv[2]) : 5;
+    if (repetitions < 1)
+        repetitions = 1;
+
+    auto [trace, err] = memory::allocation_trace::load(argv[1]);
+
+    if (err != error::no_error) {
+        fprintf(stderr, "Cannot read trace '%s': %s\n", argv[1], err.get_description());
+        return 1;
+    }
+
+    printf("%-12s %12s %10s %12s %14s\n", "allocator", "operations", "failures", "ns/op", "peak bytes");
+
+    run<memory::heap_allocator>("heap", trace, repetitions);
+    run<freelist_heap>("freelist", trace, repetitions);
+    run<bucketized_heap>("bucketizer", trace, repetitions);
+    run<arena_heap>("arena", trace, repetitions);
+    run<cached_heap>("threadcache", trace, repetitions);
+
+    return 0;
+}
@@ -3,12 +3,48 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <memory_resource>
+#include <mutex>
+#include <new>
+#include <type_traits>
+#include <unordered_map>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
 
 #include "errors.h"
 #include "stdalias.h"
 
 namespace ltd
 {
+    /**
+     * @brief
+     * True if a T can be moved to another address with `memcpy()`, leaving
+     * nothing to destroy at the old address.
+     * 
+     * @details
+     * Trivially copyable types are relocatable. Other types opt in by
+     * specializing the trait, which is sound as long as they neither point
+     * into themselves nor hand out their own address, like the smart pointers
+     * of the library or most handles:
+     * ```C++
+     *      template<>
+     *      constexpr bool ltd::is_trivially_relocatable<connection> = true;
+     * ```
+     */
+    template<typename T>
+    constexpr bool is_trivially_relocatable = std::is_trivially_copyable<T>::value;
+
     /**
      * @brief
      * Holds classes and functions
@@ -47,6 +83,28 @@ namespace ltd
             (*instance).~T();
         }
 
+        /**
+         * The default alignment of blocks returned by ltd's allocators.
+         */
+        constexpr size_t default_alignment = alignof(std::max_align_t);
+
+        /**
+         * Check whether the value is a power of two, as every alignment must be.
+         */
+        constexpr bool is_power_of_two(size_t value)
+        {
+            return value != 0 && (value & (value - 1)) == 0;
+        }
+
+        /**
+         * Round the size up to the next multiple of alignment. The alignment
+         * must be a power of two.
+         */
+        constexpr size_t align_up(size_t size, size_t alignment)
+        {
+            return (size + alignment - 1) & ~(alignment - 1);
+        }
+
         /**
          * memory::block is used as the container for memory allocation and deallocation.
          */
@@ -57,14 +115,440 @@ namespace ltd
         };
 
         class global_allocator;
+        class heap_allocator;
+
+        /**
+         * True if the allocator provides `allocate(size, alignment)`.
+         */
+        template<typename A, typename = void>
+        constexpr bool has_aligned_allocate = false;
+
+        template<typename A>
+        constexpr bool has_aligned_allocate<A, decltype(std::declval<A&>().allocate(size_t(), size_t()), void())> = true;
+
+        /**
+         * @brief
+         * Allocate an aligned block from any allocator.
+         * 
+         * @details
+         * Calls `allocate(size, alignment)` when the allocator provides it.
+         * Allocators that only provide `allocate(size)` can serve alignments up
+         * to `default_alignment` and fail for larger ones.
+         */
+        template<typename A>
+        ret<block,error> allocate_aligned(A& allocator, size_t allocation_size, size_t alignment)
+        {
+            if constexpr (has_aligned_allocate<A>) {
+                return allocator.allocate(allocation_size, alignment);
+            } else {
+                if (alignment > default_alignment)
+                    return {{nullptr, 0}, error::allocation_failure};
+
+                return allocator.allocate(allocation_size);
+            }
+        }
+
+        /**
+         * True if the allocator provides `expand(block, delta, alignment)`.
+         */
+        template<typename A, typename = void>
+        constexpr bool has_aligned_expand = false;
+
+        template<typename A>
+        constexpr bool has_aligned_expand<A, decltype(std::declval<A&>().expand(std::declval<block&>(), size_t(), size_t()), void())> = true;
+
+        /**
+         * @brief
+         * Expand an aligned block with any allocator.
+         * 
+         * @details
+         * Calls `expand(block, delta, alignment)` when the allocator provides
+         * it, so that a moved block keeps its alignment. Other allocators can
+         * expand blocks aligned up to `default_alignment` and fail for larger
+         * ones.
+         */
+        template<typename A>
+        error expand_aligned(A& allocator, block& allocated_block, size_t delta, size_t alignment)
+        {
+            if constexpr (has_aligned_expand<A>) {
+                return allocator.expand(allocated_block, delta, alignment);
+            } else {
+                if (alignment > default_alignment)
+                    return error::allocation_failure;
+
+                return allocator.expand(allocated_block, delta);
+            }
+        }
+
+        /**
+         * @brief
+         * Move count objects to uninitialized memory and destroy the originals.
+         * 
+         * @details
+         * Trivially relocatable types are moved with a single `memcpy()`, the
+         * others are move constructed and destroyed one by one. The ranges must
+         * not overlap.
+         */
+        template<typename T>
+        void relocate(T *destination, T *source, size_t count)
+        {
+            if constexpr (is_trivially_relocatable<T>) {
+                if (count > 0)
+                    memcpy((void*)destination, (const void*)source, count * sizeof(T));
+            } else {
+                for (size_t i=0; i<count; i++) {
+                    new (destination + i) T(std::move(source[i]));
+                    source[i].~T();
+                }
+            }
+        }
+
+        /**
+         * @brief
+         * Grow a buffer of objects to hold capacity of them, relocating the
+         * objects it holds when it cannot grow in place.
+         * 
+         * @details
+         * Buffers of trivially relocatable types first try `expand()`, which
+         * grows the block in place or lets the allocator move it with
+         * `realloc()` or `mremap()`. When that fails, and always for the other
+         * types, a new block aligned for T is allocated, the objects are
+         * relocated into it and the old block is deallocated. An empty buffer
+         * gets a new block. On failure the objects stay where they are.
+         * ```C++
+         *      memory::block buffer{nullptr, 0};
+         *      auto err = memory::relocate<pointer<session>>(allocator, buffer, size, 2 * size);
+         * ```
+         * 
+         * @param allocator The allocator of the buffer.
+         * @param buffer    The buffer, updated to the grown block.
+         * @param count     The number of objects at the start of the buffer.
+         * @param capacity  The number of objects the buffer must hold.
+         */
+        template<typename T, typename A>
+        error relocate(A& allocator, block& buffer, size_t count, size_t capacity)
+        {
+            if (count > capacity || (buffer.ptr == nullptr && count > 0))
+                return error::invalid_argument;
+
+            if (capacity > SIZE_MAX / sizeof(T))
+                return error::allocation_failure;
+
+            size_t size = capacity * sizeof(T);
+
+            if (buffer.ptr != nullptr && size <= buffer.size)
+                return error::no_error;
+
+            if constexpr (is_trivially_relocatable<T>) {
+                if (buffer.ptr != nullptr) {
+                    block expanded = buffer;
+
+                    if (expand_aligned(allocator, expanded, size - buffer.size, alignof(T)) == error::no_error) {
+                        buffer = expanded;
+                        return error::no_error;
+                    }
+                }
+            }
+
+            auto [blk, err] = allocate_aligned(allocator, size, alignof(T));
+            if (err != error::no_error)
+                return err;
+
+            if (buffer.ptr != nullptr) {
+                relocate((T*)blk.ptr, (T*)buffer.ptr, count);
+                allocator.deallocate(buffer);
+            }
+
+            buffer = blk;
+            return error::no_error;
+        }
+
+        /**
+         * True if the allocator provides `allocate_batch(size, count, out)`.
+         */
+        template<typename A, typename = void>
+        constexpr bool has_allocate_batch = false;
+
+        template<typename A>
+        constexpr bool has_allocate_batch<A, decltype(std::declval<A&>().allocate_batch(size_t(), size_t(), (block*)nullptr), void())> = true;
+
+        /**
+         * True if the allocator provides `deallocate_batch(blocks, count)`.
+         */
+        template<typename A, typename = void>
+        constexpr bool has_deallocate_batch = false;
+
+        template<typename A>
+        constexpr bool has_deallocate_batch<A, decltype(std::declval<A&>().deallocate_batch((block*)nullptr, size_t()), void())> = true;
+
+        /**
+         * @brief
+         * Allocate count blocks of the same size from any allocator.
+         * 
+         * @details
+         * Calls `allocate_batch(size, count, out)` when the allocator provides
+         * it, which pools implement by handing out many blocks under a single
+         * lock or bounds check. Other allocators are called once per block.
+         * Allocation stops at the first failure, the blocks allocated so far are
+         * kept in out and belong to the caller.
+         * ```C++
+         *      memory::block nodes[64];
+         *      auto [count, err] = memory::allocate_batch(pool, sizeof(node), 64, nodes);
+         * ```
+         * 
+         * @return ret<size_t,error> The number of blocks written to out and the
+         *         error that stopped the batch, if any.
+         */
+        template<typename A>
+        ret<size_t,error> allocate_batch(A& allocator, size_t allocation_size, size_t count, block *out)
+        {
+            if constexpr (has_allocate_batch<A>) {
+                return allocator.allocate_batch(allocation_size, count, out);
+            } else {
+                for (size_t i=0; i<count; i++) {
+                    auto [blk, err] = allocator.allocate(allocation_size);
+                    if (err != error::no_error)
+                        return {i, err};
+
+                    out[i] = blk;
+                }
+
+                return {count, error::no_error};
+            }
+        }
+
+        /**
+         * @brief
+         * Deallocate count blocks with any allocator, calling its
+         * `deallocate_batch(blocks, count)` when it provides it.
+         * 
+         * @return error The first error returned, every block is deallocated
+         *         regardless.
+         */
+        template<typename A>
+        error deallocate_batch(A& allocator, block *blocks, size_t count)
+        {
+            if constexpr (has_deallocate_batch<A>) {
+                return allocator.deallocate_batch(blocks, count);
+            } else {
+                error result = error::no_error;
+
+                for (size_t i=0; i<count; i++) {
+                    auto err = allocator.deallocate(blocks[i]);
+                    if (result == error::no_error)
+                        result = err;
+                }
+
+                return result;
+            }
+        }
+
+        /**
+         * True if one instance of A can serve every thread. Empty allocators
+         * can, the others tell with a `thread_safe` member, i.e.
+         * `static constexpr bool thread_safe = true;`.
+         */
+        template<typename A, typename = void>
+        constexpr bool is_thread_safe_allocator = std::is_empty<A>::value;
+
+        template<typename A>
+        constexpr bool is_thread_safe_allocator<A, decltype((void)A::thread_safe)> = A::thread_safe;
+
+        /**
+         * @brief
+         * Get the instance of A used when no instance is given, i.e. by
+         * `make_object<T,D,A>()` without an allocator argument.
+         * 
+         * @details
+         * Thread safe allocators, see `is_thread_safe_allocator`, have one
+         * instance for the whole process. The others, such as arenas, stacks
+         * and freelists, have one instance per thread so that threads never
+         * race on its state. Their blocks must be released on the thread that
+         * allocated them, before it exits.
+         */
+        template<typename A>
+        A& shared_allocator()
+        {
+            if constexpr (is_thread_safe_allocator<A>) {
+                static A instance;
+                return instance;
+            } else {
+                thread_local A instance;
+                return instance;
+            }
+        }
+
+        /**
+         * True if A is one of the default allocators, i.e. the allocators that an
+         * `allocator_scope` overrides.
+         */
+        template<typename A>
+        constexpr bool is_default_allocator = std::is_same<A, heap_allocator>::value ||
+                                              std::is_same<A, global_allocator>::value;
+
+        /**
+         * Functions to reach an allocator whose type is not known statically.
+         */
+        struct allocator_ops
+        {
+            ret<block,error> (*allocate)(void *instance, size_t allocation_size, size_t alignment);
+            error            (*deallocate)(void *instance, block allocated_block);
+        };
+
+        /**
+         * An allocator instance along with the functions to use it.
+         */
+        struct allocator_binding
+        {
+            void                *instance;
+            const allocator_ops *ops;
+
+            ret<block,error> allocate(size_t allocation_size, size_t alignment) const
+            {
+                return ops->allocate(instance, allocation_size, alignment);
+            }
+
+            error deallocate(block allocated_block) const
+            {
+                return ops->deallocate(instance, allocated_block);
+            }
+        };
+
+        /**
+         * @brief
+         * Routes the default allocations of the calling thread to an allocator
+         * instance for the lifetime of the scope.
+         * 
+         * @details
+         * While the scope is alive, every `make_object()` and `memory::make()`
+         * on the same thread that would use the default allocator, i.e.
+         * `heap_allocator` or `global_allocator`, allocates from the given
+         * instance instead. Scopes nest, the innermost one wins. A whole request
+         * can then live in one arena without passing it to every call:
+         * ```C++
+         *      memory::arena_allocator arena;
+         *      {
+         *          memory::allocator_scope scope(arena);
+         *          handle_request(); // every make_object() draws from the arena
+         *      }
+         *      arena.deallocate_all();
+         * ```
+         * 
+         * Objects remember the allocator they came from, so they may outlive
+         * the scope, but not the allocator instance.
+         */
+        class allocator_scope
+        {
+            allocator_binding        binding;
+            const allocator_binding *previous;
+
+            static inline thread_local const allocator_binding *active = nullptr;
+
+        public:
+            template<typename A>
+            allocator_scope(A& allocator) : binding{&allocator, &ops_of<A>}, previous(active)
+            {
+                active = &binding;
+            }
+
+            allocator_scope(const allocator_scope& other) = delete;
+            allocator_scope& operator=(const allocator_scope& other) = delete;
+
+            ~allocator_scope()
+            {
+                active = previous;
+            }
+
+            /**
+             * @brief
+             * Get the innermost scope of the calling thread.
+             * 
+             * @return const allocator_binding* The allocator of the scope or
+             *         nullptr if there is no scope.
+             */
+            static const allocator_binding *current()
+            {
+                return active;
+            }
+
+        private:
+            template<typename A>
+            static constexpr allocator_ops ops_of = {
+                [](void *instance, size_t allocation_size, size_t alignment) {
+                    return allocate_aligned(*(A*)instance, allocation_size, alignment);
+                },
+                [](void *instance, block allocated_block) {
+                    return ((A*)instance)->deallocate(allocated_block);
+                }
+            };
+        };
+
+        /**
+         * @brief
+         * Refers to the allocator instance that owns a block.
+         * 
+         * @details
+         * Smart pointers keep an `allocator_ref` so they release their block to
+         * the allocator instance it came from. For stateless allocators, i.e.
+         * empty classes, every instance is equivalent and the reference is an
+         * empty class too, which costs nothing as a base class. Stateful
+         * allocators are referred to by pointer, and default to the
+         * `shared_allocator<A>()` instance.
+         * 
+         * @tparam A The allocator type.
+         */
+        template<typename A, bool Stateless = std::is_empty<A>::value>
+        class allocator_ref
+        {
+            A *instance;
+
+        public:
+            allocator_ref() : instance(&shared_allocator<A>())
+            {}
+
+            allocator_ref(A& allocator) : instance(&allocator)
+            {}
+
+            A& get() const { return *instance; }
+        };
+
+        template<typename A>
+        class allocator_ref<A, true>
+        {
+        public:
+            allocator_ref()
+            {}
+
+            allocator_ref(A& allocator)
+            {}
+
+            A& get() const { return shared_allocator<A>(); }
+        };
 
         /**
          * The standard interface for allocators.
+         * 
+         * `allocate(size, alignment)` returns a block whose address is a multiple
+         * of alignment, which must be a power of two. `allocate(size)` aligns to
+         * `default_alignment`. Blocks are deallocated the same way regardless of
+         * their alignment.
+         * 
+         * `expand(block, delta)` grows the block by delta bytes. Most allocators
+         * only grow blocks in place. Those that may move the block, such as the
+         * heap, update `block.ptr`, so comparing it with the old address tells
+         * whether the content moved. The old address is invalid after a move.
+         * 
+         * Allocators that can serve many blocks of the same size cheaper than
+         * one by one also provide `allocate_batch(size, count, out)` and
+         * `deallocate_batch(blocks, count)`. Use them through
+         * `memory::allocate_batch()` and `memory::deallocate_batch()`, which
+         * fall back to one call per block for the other allocators.
          */
         class null_allocator
         {
         public:
             ret<block,error> allocate(size_t allocation_size);
+            ret<block,error> allocate(size_t allocation_size, size_t alignment);
             ret<block,error> allocate_all();
 
             error deallocate(block allocated_block);
@@ -79,43 +563,4384 @@ namespace ltd
          * @brief
          * Allocates and deallocates memory from the heap using `malloc()`
          * and `free()`.
+         * 
+         * @details
+         * The heap has no way to tell its blocks apart from the others, so
+         * `owns()` claims every non-null block. Put it last in a composition,
+         * i.e. as the fallback of a `fallback_allocator`.
+         * 
+         * `expand()` first uses the slack of the chunk `malloc()` returned, then
+         * falls back to `realloc()`, which may move the block. Blocks allocated
+         * with more than `default_alignment` are expanded with the alignment
+         * they were allocated with, which moves them to a new aligned chunk
+         * instead. A failed expand leaves the block untouched.
          */
         class heap_allocator
         {
         public:
             ret<block,error> allocate(size_t allocation_size);
+            ret<block,error> allocate(size_t allocation_size, size_t alignment);
             ret<block,error> allocate_all();
 
             error deallocate(block allocated_block);
             error deallocate_all();
 
             error expand(block& allocated_block, size_t delta);
+            error expand(block& allocated_block, size_t delta, size_t alignment);
 
             ret<bool,error> owns(block mem_block);
         };
 
         /**
          * @brief
-         * Instantiate a C++ object using ltd's allocator framework.
+         * Give the whole pages inside a range back to the kernel.
          * 
-         * @tparam T The class to be instantiated
-         * @tparam A The allocator type. Define global_allocator to override the
-         *           default `heap_allocator`.
-         * @tparam P The variadic template for the constructor
-         * @param args
-         * @return ret<T*,error> The raw pointer to T and an error status.
+         * @details
+         * The pages are released with `MADV_FREE`, so the kernel only reclaims
+         * them under memory pressure and reusing them is free until then. Kernels
+         * without it get `MADV_DONTNEED`. The range stays mapped but its content
+         * is lost. Partial pages at both ends are left untouched.
+         * 
+         * @return size_t The number of bytes given back.
          */
-        template<typename T,
-                 typename A=typename std::conditional<is_defined<memory::global_allocator>,
-                                                                 memory::global_allocator,
-                                                                 memory::heap_allocator>::type,
-                 typename... P>
-        ret<T*,error> make(P&&... args)
+        size_t purge_pages(void *ptr, size_t size);
+
+        /**
+         * @brief
+         * Set how long the arenas, regions and freelists keep memory they no
+         * longer use before they purge its pages, 0 to never purge on their own.
+         * The default is 10 seconds.
+         */
+        void set_purge_decay(std::chrono::milliseconds decay);
+
+        /**
+         * @brief
+         * Get how long unused memory is kept before its pages are purged.
+         */
+        std::chrono::milliseconds get_purge_decay();
+
+        /**
+         * @brief
+         * Tells an allocator when a decay period has passed.
+         * 
+         * @details
+         * Allocators check the clock from their own `deallocate()` and
+         * `deallocate_all()` calls rather than from a background thread, so
+         * purging never races with allocators that are not thread safe.
+         */
+        class decay_clock
         {
-            using allocator_type = typename std::conditional<is_defined<A>, A, memory::heap_allocator>::type;
+            int64_t start;
+
+        public:
+            decay_clock();
+
+            /**
+             * @brief
+             * Check whether the decay period has passed since the last time this
+             * returned true, and start the next period if it did.
+             */
+            bool elapsed();
+        };
+
+        /**
+         * True if the allocator provides `purge()`.
+         */
+        template<typename A, typename = void>
+        constexpr bool has_purge = false;
+
+        template<typename A>
+        constexpr bool has_purge<A, decltype(std::declval<A&>().purge(), void())> = true;
+
+        /**
+         * @brief
+         * Give the unused pages of any allocator back to the kernel.
+         * 
+         * @return size_t The number of bytes given back, 0 for allocators
+         *         without `purge()`.
+         */
+        template<typename A>
+        size_t purge(A& allocator)
+        {
+            if constexpr (has_purge<A>)
+                return allocator.purge();
+            else
+                return 0;
+        }
+
+        /**
+         * @brief
+         * Enrolls an allocator in `memory::purge()` for its lifetime.
+         * 
+         * @details
+         * The registered allocator is purged by the thread calling
+         * `memory::purge()`. Allocators that are not thread safe must only be
+         * registered when that thread is the one using them.
+         * ```C++
+         *      memory::arena_allocator arena(1ul << 20);
+         *      memory::purge_registration registration(arena);
+         *      ...
+         *      memory::purge();
+         * ```
+         */
+        class purge_registration
+        {
+            void *instance;
+
+        public:
+            template<typename A>
+            purge_registration(A& allocator) : instance(&allocator)
+            {
+                enroll(instance, [](void *a) { return memory::purge(*(A*)a); });
+            }
+
+            purge_registration(const purge_registration& other) = delete;
+            purge_registration& operator=(const purge_registration& other) = delete;
+
+            ~purge_registration();
+
+        private:
+            static void enroll(void *allocator, size_t (*purge)(void*));
+        };
+
+        /**
+         * @brief
+         * Purge every allocator enrolled with a `purge_registration`.
+         * 
+         * @return size_t The number of bytes given back.
+         */
+        size_t purge();
+
+        /**
+         * True if the allocator provides `shrink()`.
+         */
+        template<typename A, typename = void>
+        constexpr bool has_shrink = false;
+
+        template<typename A>
+        constexpr bool has_shrink<A, decltype(std::declval<A&>().shrink(), void())> = true;
+
+        /**
+         * @brief
+         * Ask any allocator to give back the memory it keeps for later use.
+         * 
+         * @details
+         * Caches such as freelists and slabs implement `shrink()` by handing
+         * their cached blocks and objects back, at the price of refilling
+         * later. Allocators without it are purged instead.
+         * 
+         * @return size_t The number of bytes given back.
+         */
+        template<typename A>
+        size_t shrink(A& allocator)
+        {
+            if constexpr (has_shrink<A>)
+                return allocator.shrink();
+            else
+                return memory::purge(allocator);
+        }
+
+        /**
+         * @brief
+         * Watches the memory pressure of the process and asks the registered
+         * allocators to shrink when it is too high.
+         * 
+         * @details
+         * Three sources are checked, any of them raises the pressure:
+         * - the `high`, `max` and `oom` counters of the cgroup v2
+         *   `memory.events` file, when they grew since the last check,
+         * - the `some avg10` share of the cgroup `memory.pressure` file (PSI),
+         *   from `set_pressure_threshold()`, 10 percent by default,
+         * - the resident set size of the process, from `set_rss_budget()`,
+         *   unlimited by default.
+         * 
+         * The cgroup of the process is found in `/proc/self/cgroup`, another
+         * cgroup directory can be given to the constructor. Without cgroup v2
+         * only the budget applies.
+         * 
+         * `poll()` checks the sources and shrinks the allocators enrolled with
+         * a `pressure_registration` on the calling thread, so it suits event
+         * loops that own allocators which are not thread safe. `start()` polls
+         * from a background thread instead, which is only safe for thread safe
+         * allocators such as slabs, thread caches and NUMA allocators.
+         * ```C++
+         *      memory::pressure_monitor monitor;
+         *      memory::pressure_registration registration(monitor, sessions);
+         * 
+         *      monitor.set_rss_budget(512ul << 20);
+         *      monitor.start(std::chrono::seconds(1));
+         * ```
+         */
+        class pressure_monitor
+        {
+            struct entry
+            {
+                void   *allocator;
+                size_t (*shrink)(void*);
+            };
+
+            std::string             events_path;
+            std::string             pressure_path;
+            uint64_t                events;
+            std::atomic<size_t>     rss_budget;
+            std::atomic<double>     pressure_threshold;
+            std::mutex              lock;
+            std::vector<entry>      entries;
+            std::thread             worker;
+            std::mutex              worker_lock;
+            std::condition_variable worker_signal;
+            bool                    running;
+
+        public:
+            /**
+             * @brief
+             * Construct a new pressure monitor.
+             * 
+             * @param cgroup The cgroup v2 directory to watch, the cgroup of the
+             *               process when null.
+             */
+            pressure_monitor(const char *cgroup = nullptr);
+
+            pressure_monitor(const pressure_monitor& other) = delete;
+            pressure_monitor& operator=(const pressure_monitor& other) = delete;
+
+            /**
+             * @brief
+             * Stop the background thread, if any.
+             */
+            ~pressure_monitor();
+
+            /**
+             * @brief
+             * Set the resident set size above which the allocators shrink, 0
+             * for no budget.
+             */
+            void set_rss_budget(size_t bytes);
+
+            /**
+             * @brief
+             * Set the share of time, in percent, stalled on memory over the
+             * last 10 seconds above which the allocators shrink, 0 to ignore
+             * PSI.
+             */
+            void set_pressure_threshold(double percent);
+
+            /**
+             * @brief
+             * Check whether a cgroup v2 memory controller is watched.
+             */
+            bool has_cgroup() const;
+
+            /**
+             * @brief
+             * Check whether any source reports pressure since the last check.
+             */
+            bool under_pressure();
+
+            /**
+             * @brief
+             * Shrink the registered allocators if the process is under pressure.
+             * 
+             * @return size_t The number of bytes given back.
+             */
+            size_t poll();
+
+            /**
+             * @brief
+             * Shrink the registered allocators now.
+             * 
+             * @return size_t The number of bytes given back.
+             */
+            size_t shrink();
+
+            /**
+             * @brief
+             * Poll from a background thread at the given interval.
+             * 
+             * @return error `invalid_operation` if the thread already runs.
+             */
+            error start(std::chrono::milliseconds interval);
+
+            /**
+             * @brief
+             * Stop the background thread and wait for it.
+             */
+            void stop();
+
+            /**
+             * @brief
+             * Get the resident set size of the process in bytes.
+             */
+            static size_t resident_size();
+
+        private:
+            friend class pressure_registration;
+
+            void enroll(void *allocator, size_t (*shrink)(void*));
+            void withdraw(void *allocator);
+        };
 
-            allocator_type allocator;
-            auto [b,e] = allocator.allocate(sizeof(T));
+        /**
+         * @brief
+         * Enrolls an allocator in a `pressure_monitor` for its lifetime. The
+         * allocator is shrunk with `memory::shrink()`.
+         */
+        class pressure_registration
+        {
+            pressure_monitor& monitor;
+            void             *instance;
+
+        public:
+            template<typename A>
+            pressure_registration(pressure_monitor& pressure, A& allocator) : monitor(pressure), instance(&allocator)
+            {
+                monitor.enroll(instance, [](void *a) { return memory::shrink(*(A*)a); });
+            }
+
+            pressure_registration(const pressure_registration& other) = delete;
+            pressure_registration& operator=(const pressure_registration& other) = delete;
+
+            ~pressure_registration()
+            {
+                monitor.withdraw(instance);
+            }
+        };
+
+        /**
+         * @brief
+         * Allocates memory by bumping a pointer inside large regions and frees
+         * everything at once.
+         * 
+         * @details
+         * The arena reserves regions of `region_size` bytes from the heap and
+         * carves blocks out of the newest region by advancing an offset. When
+         * the region is exhausted a new one is reserved. Requests larger than
+         * `region_size` get a region of their own.
+         * 
+         * Individual `deallocate()` calls only give the memory back when the
+         * block is the last one carved from the newest region. Every other block
+         * is released by `deallocate_all()`, which keeps the newest region for
+         * reuse and frees the rest. All regions are freed when the arena is
+         * destroyed.
+         * 
+         * `purge()` gives the pages of the newest region that are not in use
+         * back to the kernel. Without it, the arena purges them when
+         * `deallocate_all()` finds that a decay period has passed, keeping the
+         * pages up to the highest offset reached during that period.
+         * 
+         * This makes the arena a good fit for request-scoped object graphs that
+         * die together:
+         * ```C++
+         *      memory::arena_allocator arena;
+         *      auto [blk, err] = arena.allocate(128);
+         *      ...
+         *      arena.deallocate_all();
+         * ```
+         */
+        class arena_allocator
+        {
+            struct region
+            {
+                region *next;
+                size_t  capacity;
+                size_t  used;
+            };
+
+            region      *head;
+            size_t       region_size;
+            size_t       peak;
+            decay_clock  decay;
+
+        public:
+            /**
+             * The default size of a region reserved by the arena.
+             */
+            static constexpr size_t default_region_size = 64 * 1024;
+
+            /**
+             * @brief
+             * Construct a new arena allocator. No memory is reserved until the
+             * first allocation.
+             * 
+             * @param size The size of the regions reserved by the arena.
+             */
+            arena_allocator(size_t size = default_region_size);
+
+            arena_allocator(const arena_allocator& other) = delete;
+            arena_allocator& operator=(const arena_allocator& other) = delete;
+
+            /**
+             * @brief
+             * Destroy the arena and free all of its regions.
+             */
+            ~arena_allocator();
+
+            ret<block,error> allocate(size_t allocation_size);
+            ret<block,error> allocate(size_t allocation_size, size_t alignment);
+            ret<block,error> allocate_all();
+
+            error deallocate(block allocated_block);
+            error deallocate_all();
+
+            error expand(block& allocated_block, size_t delta);
+
+            ret<bool,error> owns(block mem_block);
+
+            /**
+             * @brief
+             * Carve count blocks of the same size out of a single region, see
+             * `memory::allocate_batch()`.
+             */
+            ret<size_t,error> allocate_batch(size_t allocation_size, size_t count, block *out);
+
+            /**
+             * @brief
+             * Give the unused pages of the newest region back to the kernel.
+             * 
+             * @return size_t The number of bytes given back.
+             */
+            size_t purge();
+
+        private:
+            static char *region_begin(region *r);
+            static size_t padding(region *r, size_t alignment);
+            ret<region*,error> reserve(size_t allocation_size);
+        };
+
+        /**
+         * The size of the huge pages requested by the kernel backed allocators.
+         */
+        constexpr size_t huge_page_size = 2 * 1024 * 1024;
+
+        /**
+         * @brief
+         * Get the size of a memory page of the system.
+         */
+        size_t page_size();
+
+        /**
+         * How kernel backed allocators use huge pages.
+         */
+        enum class huge_page_mode {
+            None,        // Regular pages only
+            Transparent, // Advise the kernel to back the memory with transparent huge pages
+            Explicit     // Map pre-reserved huge pages with MAP_HUGETLB
+        };
+
+        /**
+         * @brief
+         * Maps every block directly from the kernel with `mmap()` and unmaps
+         * it with `munmap()`.
+         * 
+         * @details
+         * Block sizes are rounded up to whole pages, or whole huge pages in
+         * `huge_page_mode::Explicit`, so this allocator suits large blocks. When
+         * huge pages are not available the allocator silently falls back to a
+         * regular mapping. `expand()` grows a block in place with `mremap()`
+         * when the address range after the block is free, and lets the kernel
+         * move the pages otherwise, which never copies the content. Blocks
+         * aligned beyond a page are expanded with the alignment they were
+         * allocated with, so that a move keeps it.
+         * 
+         * Like the heap, it cannot tell its blocks apart from others and claims
+         * every non-null page aligned block.
+         */
+        class mmap_allocator
+        {
+            huge_page_mode mode;
+
+        public:
+            /**
+             * Every thread can share an instance.
+             */
+            static constexpr bool thread_safe = true;
+
+            /**
+             * @brief
+             * Construct a new mmap allocator.
+             * 
+             * @param huge_pages The huge page mode.
+             */
+            mmap_allocator(huge_page_mode huge_pages = huge_page_mode::None);
+
+            ret<block,error> allocate(size_t allocation_size);
+            ret<block,error> allocate(size_t allocation_size, size_t alignment);
+            ret<block,error> allocate_all();
+
+            error deallocate(block allocated_block);
+            error deallocate_all();
+
+            error expand(block& allocated_block, size_t delta);
+            error expand(block& allocated_block, size_t delta, size_t alignment);
+
+            ret<bool,error> owns(block mem_block);
+
+        private:
+            size_t mapping_size(size_t size) const;
+        };
+
+        /**
+         * @brief
+         * Bump allocator over a large virtual address range reserved from the
+         * kernel and committed lazily.
+         * 
+         * @details
+         * The whole range is reserved up front without access rights, which costs
+         * no memory. It is committed in steps of `huge_page_size` as the allocation
+         * offset advances. Like the arena, only the latest block can be freed or
+         * expanded, `deallocate_all()` resets the region.
+         * 
+         * With `huge_page_mode::Explicit` the range is mapped with `MAP_HUGETLB`.
+         * If that fails the region falls back to transparent huge pages, and to
+         * regular pages when the kernel refuses the advice. `get_mode()` tells
+         * which mode was granted.
+         * 
+         * Committed pages stay committed after `deallocate_all()`. `purge()`
+         * gives those above the allocation offset back to the kernel, and
+         * `deallocate_all()` does the same once a decay period has passed,
+         * keeping the pages up to the highest offset reached during that period.
+         * Explicit huge pages are never purged.
+         * 
+         * ```C++
+         *      memory::region_allocator index_memory(16ul << 30, memory::huge_page_mode::Transparent);
+         * ```
+         */
+        class region_allocator
+        {
+            char           *base;
+            size_t          reserved;
+            size_t          committed;
+            size_t          used;
+            void           *mapping;
+            size_t          mapping_length;
+            huge_page_mode  mode;
+            size_t          peak;
+            decay_clock     decay;
+
+        public:
+            /**
+             * @brief
+             * Construct a new region allocator. Check `get_mode()` or `owns()`
+             * to find out whether the reservation succeeded.
+             * 
+             * @param size       The size of the range to reserve.
+             * @param huge_pages The requested huge page mode.
+             */
+            region_allocator(size_t size, huge_page_mode huge_pages = huge_page_mode::None);
+
+            region_allocator(const region_allocator& other) = delete;
+            region_allocator& operator=(const region_allocator& other) = delete;
+
+            /**
+             * @brief
+             * Destroy the region and give the whole range back to the kernel.
+             */
+            ~region_allocator();
+
+            ret<block,error> allocate(size_t allocation_size);
+            ret<block,error> allocate(size_t allocation_size, size_t alignment);
+            ret<block,error> allocate_all();
+
+            error deallocate(block allocated_block);
+            error deallocate_all();
+
+            error expand(block& allocated_block, size_t delta);
+
+            ret<bool,error> owns(block mem_block);
+
+            /**
+             * @brief
+             * Get the huge page mode granted by the kernel.
+             */
+            huge_page_mode get_mode() const;
+
+            /**
+             * @brief
+             * Get the size of the reserved range, 0 if the reservation failed.
+             */
+            size_t capacity() const;
+
+            /**
+             * @brief
+             * Carve count contiguous blocks of the same size with a single
+             * bounds check and commit, see `memory::allocate_batch()`.
+             */
+            ret<size_t,error> allocate_batch(size_t allocation_size, size_t count, block *out);
+
+            /**
+             * @brief
+             * Give the committed pages above the allocation offset back to the
+             * kernel.
+             * 
+             * @return size_t The number of bytes given back.
+             */
+            size_t purge();
+
+        private:
+            friend class numa_allocator;
+
+            error commit(size_t size);
+        };
+
+        /**
+         * @brief
+         * Keeps one region per NUMA node and serves every thread from the node
+         * it runs on.
+         * 
+         * @details
+         * The range of each region is bound to its node with `mbind` before any
+         * page is touched. This way the memory lands on the node of the thread
+         * that allocated it, not on the node of the thread that touches it first.
+         * The binding uses the preferred policy so an exhausted node spills over
+         * to the others instead of failing.
+         * 
+         * `allocate()` looks up the node of the calling thread with `getcpu`, and
+         * `allocate_on()` targets a node explicitly. Blocks are freed to the
+         * region that owns them, in last-in-first-out order like the region.
+         * Each node has its own lock, so threads on different nodes do not
+         * contend.
+         * 
+         * On machines without NUMA, or when the kernel lacks the system calls,
+         * the allocator degrades to a single region without binding.
+         * ```C++
+         *      memory::numa_allocator sessions(1ul << 30);
+         *      auto obj = make_object<session>(std::allocator_arg, sessions, id);
+         * ```
+         */
+        class numa_allocator
+        {
+        public:
+            /**
+             * The largest number of nodes served, the others fold onto them.
+             */
+            static constexpr size_t max_nodes = 64;
+
+        private:
+            struct node_region
+            {
+                region_allocator region;
+                std::mutex       lock;
+
+                node_region(size_t size, huge_page_mode huge_pages) : region(size, huge_pages) {}
+            };
+
+            std::vector<std::unique_ptr<node_region>> nodes;
+            bool                                      bound;
+
+        public:
+            /**
+             * @brief
+             * Construct a new NUMA allocator.
+             * 
+             * @param size_per_node The size of the range reserved on each node.
+             * @param huge_pages    The requested huge page mode of the regions.
+             */
+            numa_allocator(size_t size_per_node, huge_page_mode huge_pages = huge_page_mode::None);
+
+            numa_allocator(const numa_allocator& other) = delete;
+            numa_allocator& operator=(const numa_allocator& other) = delete;
+
+            ret<block,error> allocate(size_t allocation_size);
+            ret<block,error> allocate(size_t allocation_size, size_t alignment);
+            ret<block,error> allocate_all();
+
+            /**
+             * @brief
+             * Allocate from the region of the given node.
+             * 
+             * @param node            The node, less than `node_count()`.
+             * @param allocation_size The size of the block.
+             * @param alignment       The alignment of the block, a power of two.
+             * @return ret<block,error> The block or `invalid_argument` for an
+             *         unknown node.
+             */
+            ret<block,error> allocate_on(size_t node, size_t allocation_size, size_t alignment = default_alignment);
+
+            error deallocate(block allocated_block);
+            error deallocate_all();
+
+            error expand(block& allocated_block, size_t delta);
+
+            ret<bool,error> owns(block mem_block);
+
+            /**
+             * @brief
+             * Get the number of regions, 1 when NUMA is not available.
+             */
+            size_t node_count() const;
+
+            /**
+             * @brief
+             * Check whether the regions are bound to their nodes.
+             */
+            bool is_bound() const;
+
+            /**
+             * @brief
+             * Get the region of the node the calling thread runs on.
+             */
+            size_t local_node() const;
+
+            /**
+             * @brief
+             * Purge the unused pages of every region under its lock.
+             * 
+             * @return size_t The number of bytes given back.
+             */
+            size_t purge();
+
+            /**
+             * @brief
+             * Get the number of NUMA nodes of the system, 1 without NUMA.
+             */
+            static size_t system_node_count();
+
+            /**
+             * @brief
+             * Get the NUMA node the calling thread runs on, 0 without NUMA.
+             */
+            static size_t current_node();
+
+        private:
+            node_region *find_owner(block mem_block);
+        };
+
+        /**
+         * @brief
+         * Heap in a memory-mapped file, which a process can open again after a
+         * restart to find its data structures as it left them.
+         * 
+         * @details
+         * The file starts with a header page holding the state of the heap:
+         * the allocation offset, one free list per power of two size class and
+         * the root. Blocks are rounded up to their size class and aligned to it,
+         * up to the page size. Freed blocks are kept on the list of their class.
+         * 
+         * The file grows by doubling when the heap is full, up to `max_size`.
+         * The whole range is reserved when the file is opened, so the mapping
+         * grows in place and blocks keep their address while the heap is open.
+         * The next run may map the file elsewhere, hence data structures in the
+         * heap must link to each other with `offset_ptr`, which stays valid
+         * wherever the file is mapped. The root is where a process finds its
+         * data again:
+         * ```C++
+         *      memory::persistent_allocator heap("/var/cache/index.heap");
+         * 
+         *      if (heap.is_new()) {
+         *          auto [index, err] = memory::make<lookup_table>(std::allocator_arg, heap);
+         *          heap.set_root(index);
+         *      }
+         * 
+         *      lookup_table *index = (lookup_table*)heap.get_root();
+         * ```
+         * 
+         * The file is locked while it is open, so two allocators, in the same
+         * process or not, never share it. Changes reach the file through the
+         * page cache, `sync()` waits until they are on the disk. The header is
+         * written to the disk before the file grows and when the root changes,
+         * so the file opens again after a crash. The blocks are not crash
+         * consistent: after a crash they may hold the changes of a half
+         * finished operation.
+         */
+        class persistent_allocator
+        {
+            int         file;
+            char       *base;
+            size_t      mapped;
+            size_t      reserved;
+            bool        created;
+            std::mutex  lock;
+
+        public:
+            /**
+             * @brief
+             * Open the heap in the file at path, or create it. Check `is_open()`
+             * to find out whether it succeeded.
+             * 
+             * @param path         The path of the heap file.
+             * @param initial_size The size of a new file, rounded up to pages.
+             * @param max_size     The size the file can grow to. Only address
+             *                     space is reserved for it.
+             */
+            persistent_allocator(const char *path, size_t initial_size = 1ul << 20, size_t max_size = 64ul << 30);
+
+            persistent_allocator(const persistent_allocator& other) = delete;
+            persistent_allocator& operator=(const persistent_allocator& other) = delete;
+
+            /**
+             * @brief
+             * Unmap the heap and close the file.
+             */
+            ~persistent_allocator();
+
+            ret<block,error> allocate(size_t allocation_size);
+            ret<block,error> allocate(size_t allocation_size, size_t alignment);
+            ret<block,error> allocate_all();
+
+            error deallocate(block allocated_block);
+            error deallocate_all();
+
+            error expand(block& allocated_block, size_t delta);
+
+            ret<bool,error> owns(block mem_block);
+
+            /**
+             * @brief
+             * Check whether the file was opened and mapped.
+             */
+            bool is_open() const;
+
+            /**
+             * @brief
+             * Check whether the file was created rather than opened again.
+             */
+            bool is_new() const;
+
+            /**
+             * @brief
+             * Get the root object, nullptr if none was set.
+             */
+            void *get_root() const;
+
+            /**
+             * @brief
+             * Set the root object, a block of the heap or nullptr.
+             */
+            error set_root(void *root);
+
+            /**
+             * @brief
+             * Get the offset of an address of the heap from the beginning of the
+             * file. Offsets stay valid when the file is mapped again.
+             */
+            size_t offset_of(const void *ptr) const;
+
+            /**
+             * @brief
+             * Get the address of an offset returned by `offset_of()`.
+             */
+            void *pointer_to(size_t offset) const;
+
+            /**
+             * @brief
+             * Write the changed pages back to the file and wait for it.
+             */
+            error sync();
+
+            /**
+             * @brief
+             * Get the size of the file.
+             */
+            size_t capacity() const;
+
+        private:
+            error grow(size_t minimum);
+            error sync_header();
+            ret<size_t,error> take(size_t size_class);
+        };
+
+        /**
+         * @brief
+         * Pointer stored as the distance from itself to its target.
+         * 
+         * @details
+         * When the pointer and its target live in the same mapping, such as a
+         * `persistent_allocator` heap, the pointer stays valid wherever the
+         * mapping is placed, also in a later run of the process. A distance of
+         * 1 stands for nullptr, since no object starts 1 byte after a pointer.
+         * 
+         * Copies compute their own distance, so an `offset_ptr` is not
+         * trivially copyable and must not be moved with `memcpy`.
+         * ```C++
+         *      struct node
+         *      {
+         *          int                    value;
+         *          memory::offset_ptr<node> next;
+         *      };
+         * ```
+         * 
+         * @tparam T The type pointed to.
+         */
+        template<typename T>
+        class offset_ptr
+        {
+            ptrdiff_t distance;
+
+        public:
+            offset_ptr() : distance(1)
+            {}
+
+            offset_ptr(T *ptr)
+            {
+                set(ptr);
+            }
+
+            offset_ptr(const offset_ptr& other)
+            {
+                set(other.get());
+            }
+
+            offset_ptr& operator=(const offset_ptr& other)
+            {
+                set(other.get());
+                return *this;
+            }
+
+            offset_ptr& operator=(T *ptr)
+            {
+                set(ptr);
+                return *this;
+            }
+
+            T *get() const
+            {
+                // The distance spans unrelated objects, so it is computed on
+                // integers rather than with pointer arithmetic.
+                return distance == 1 ? nullptr : (T*)((uintptr_t)this + (uintptr_t)distance);
+            }
+
+            T& operator*() const
+            {
+                return *get();
+            }
+
+            T *operator->() const
+            {
+                return get();
+            }
+
+            explicit operator bool() const
+            {
+                return distance != 1;
+            }
+
+            bool operator==(const offset_ptr& other) const
+            {
+                return get() == other.get();
+            }
+
+            bool operator!=(const offset_ptr& other) const
+            {
+                return get() != other.get();
+            }
+
+        private:
+            void set(T *ptr)
+            {
+                distance = ptr == nullptr ? 1 : (ptrdiff_t)((uintptr_t)ptr - (uintptr_t)this);
+            }
+        };
+
+        /**
+         * Inline storage of N bytes used by allocators that can live on the
+         * stack. The specialisation for 0 holds no storage at all.
+         */
+        template<size_t N>
+        struct inline_storage
+        {
+            alignas(default_alignment) char data[N];
+
+            char *get() { return data; }
+        };
+
+        template<>
+        struct inline_storage<0>
+        {
+            char *get() { return nullptr; }
+        };
+
+        /**
+         * @brief
+         * Allocates memory from a fixed buffer in last-in-first-out order.
+         * 
+         * @details
+         * The buffer is either `Capacity` bytes of inline storage, so the
+         * allocator lives wherever it is declared, or storage supplied by the
+         * caller. Use `Capacity` of 0 for the latter to avoid carrying an unused
+         * inline buffer.
+         * 
+         * Only the most recently allocated block can be freed or expanded. A
+         * block freed out of order stays reserved until the allocator is rolled
+         * back below it to a marker, or everything is deallocated:
+         * ```C++
+         *      memory::stack_allocator<4096> scratch;
+         *      auto mark = scratch.save();
+         *      auto [tmp, err] = scratch.allocate(256);
+         *      ...
+         *      scratch.restore(mark);
+         * ```
+         * 
+         * @tparam Capacity The size of the inline storage in bytes.
+         */
+        template<size_t Capacity>
+        class stack_allocator
+        {
+            inline_storage<Capacity> storage;
+
+            char   *buffer;
+            size_t  capacity;
+            size_t  top;
+
+        public:
+            /**
+             * A position in the stack that can be restored later.
+             */
+            using marker = size_t;
+
+            /**
+             * @brief
+             * Construct a stack allocator over its inline storage.
+             */
+            stack_allocator() : capacity(Capacity), top(0)
+            {
+                buffer = storage.get();
+            }
+
+            /**
+             * @brief
+             * Construct a stack allocator over storage supplied by the caller.
+             * The storage must outlive the allocator.
+             * 
+             * @param external The storage to allocate from.
+             * @param size     The size of the storage in bytes.
+             */
+            stack_allocator(void *external, size_t size) : top(0)
+            {
+                char *begin = (char*)align_up((size_t)external, default_alignment);
+                size_t skew = begin - (char*)external;
+
+                buffer   = begin;
+                capacity = external != nullptr && size > skew ? size - skew : 0;
+            }
+
+            stack_allocator(const stack_allocator& other) = delete;
+            stack_allocator& operator=(const stack_allocator& other) = delete;
+
+            ret<block,error> allocate(size_t allocation_size)
+            {
+                return allocate(allocation_size, default_alignment);
+            }
+
+            ret<block,error> allocate(size_t allocation_size, size_t alignment)
+            {
+                if (allocation_size == 0 || is_power_of_two(alignment) == false)
+                    return {{nullptr, 0}, error::invalid_argument};
+
+                size_t rounded = align_up(allocation_size, default_alignment);
+                size_t offset  = align_up((size_t)(buffer + top), alignment) - (size_t)buffer;
+
+                if (offset > capacity || capacity - offset < rounded)
+                    return {{nullptr, 0}, error::allocation_failure};
+
+                block blk{buffer + offset, allocation_size};
+                top = offset + rounded;
+
+                return {blk, error::no_error};
+            }
+
+            ret<block,error> allocate_all()
+            {
+                if (top == capacity)
+                    return {{nullptr, 0}, error::allocation_failure};
+
+                block blk{buffer + top, capacity - top};
+                top = capacity;
+
+                return {blk, error::no_error};
+            }
+
+            error deallocate(block allocated_block)
+            {
+                if (allocated_block.ptr == nullptr)
+                    return error::null_pointer;
+
+                auto [owned, err] = owns(allocated_block);
+                if (owned == false)
+                    return error::invalid_address;
+
+                // A block freed out of order stays reserved until restore() or
+                // deallocate_all() rolls the stack back below it.
+                if (is_top(allocated_block))
+                    top = (char*)allocated_block.ptr - buffer;
+
+                return error::no_error;
+            }
+
+            error deallocate_all()
+            {
+                top = 0;
+                return error::no_error;
+            }
+
+            error expand(block& allocated_block, size_t delta)
+            {
+                if (allocated_block.ptr == nullptr)
+                    return error::null_pointer;
+
+                if (is_top(allocated_block) == false)
+                    return error::allocation_failure;
+
+                size_t offset   = (char*)allocated_block.ptr - buffer;
+                size_t expanded = align_up(allocated_block.size + delta, default_alignment);
+
+                if (capacity - offset < expanded)
+                    return error::allocation_failure;
+
+                top = offset + expanded;
+                allocated_block.size += delta;
+
+                return error::no_error;
+            }
+
+            ret<bool,error> owns(block mem_block)
+            {
+                char *ptr = (char*)mem_block.ptr;
+                return {ptr >= buffer && ptr < buffer + capacity, error::no_error};
+            }
+
+            /**
+             * @brief
+             * Save the current top of the stack.
+             * 
+             * @return marker The marker to pass to `restore()`.
+             */
+            marker save() const
+            {
+                return top;
+            }
+
+            /**
+             * @brief
+             * Free every block allocated after the marker was saved.
+             * 
+             * @param mark A marker returned by `save()`.
+             * @return error error::invalid_argument if the marker is above the
+             *         current top of the stack.
+             */
+            error restore(marker mark)
+            {
+                if (mark > top)
+                    return error::invalid_argument;
+
+                top = mark;
+                return error::no_error;
+            }
+
+            /**
+             * @brief
+             * Get the number of bytes left in the stack.
+             */
+            size_t available() const
+            {
+                return capacity - top;
+            }
+
+        private:
+            bool is_top(block mem_block) const
+            {
+                size_t rounded = align_up(mem_block.size, default_alignment);
+                return (char*)mem_block.ptr + rounded == buffer + top;
+            }
+        };
+
+        /**
+         * @brief
+         * Caches freed blocks of a size window and recycles them for later
+         * allocations before falling back to the parent allocator.
+         * 
+         * @details
+         * Every request with a size between `MinSize` and `MaxSize` inclusive is
+         * served with a block of `MaxSize` bytes, so any cached block can serve
+         * any request in the window. Up to `MaxCached` freed blocks are kept in an
+         * intrusive singly linked list threaded through the blocks themselves.
+         * Requests outside of the window go straight to the parent.
+         * 
+         * Cached blocks larger than a page keep their pages until they are
+         * purged. `purge()` gives the pages of every cached block back to the
+         * kernel, except the one holding the link. On its own, the list purges
+         * the blocks that stayed cached through a whole decay period. The blocks
+         * remain in the list, so this works with parents that cannot take
+         * blocks back, such as regions.
+         * 
+         * A freelist in front of the heap recycles the fixed size blocks that
+         * `make_object<T>()` churns through:
+         * ```C++
+         *      memory::freelist<memory::heap_allocator, 16, 64, 1024> allocator;
+         * ```
+         * 
+         * @tparam Parent    The allocator to get blocks from.
+         * @tparam MinSize   The smallest request served from the list.
+         * @tparam MaxSize   The largest request served from the list.
+         * @tparam MaxCached The maximum number of blocks kept in the list.
+         */
+        template<typename Parent, size_t MinSize, size_t MaxSize, size_t MaxCached>
+        class freelist
+        {
+            static_assert(MinSize <= MaxSize, "MinSize must not be larger than MaxSize");
+            static_assert(MaxSize >= sizeof(void*), "MaxSize must be able to hold a pointer");
+
+            struct node
+            {
+                node *next;
+            };
+
+            Parent       parent;
+            node        *root;
+            size_t       count;
+            size_t       idle;
+            size_t       deallocations;
+            decay_clock  decay;
+
+        public:
+            using parent_type = Parent;
+
+            freelist() : root(nullptr), count(0), idle(0), deallocations(0)
+            {}
+
+            freelist(const freelist& other) = delete;
+            freelist& operator=(const freelist& other) = delete;
+
+            /**
+             * @brief
+             * Destroy the freelist and give the cached blocks back to the parent.
+             */
+            ~freelist()
+            {
+                release_cached();
+            }
+
+            ret<block,error> allocate(size_t allocation_size)
+            {
+                if (in_window(allocation_size) == false)
+                    return parent.allocate(allocation_size);
+
+                if (root != nullptr) {
+                    node *n = root;
+                    root = n->next;
+                    count--;
+
+                    if (count < idle)
+                        idle = count;
+
+                    return {{n, allocation_size}, error::no_error};
+                }
+
+                auto [blk, err] = parent.allocate(MaxSize);
+                if (err != error::no_error)
+                    return {{nullptr, 0}, err};
+
+                blk.size = allocation_size;
+                return {blk, error::no_error};
+            }
+
+            ret<block,error> allocate(size_t allocation_size, size_t alignment)
+            {
+                if (alignment <= default_alignment)
+                    return allocate(allocation_size);
+
+                if (in_window(allocation_size) == false)
+                    return allocate_aligned(parent, allocation_size, alignment);
+
+                // Over-aligned blocks bypass the cache but are still MaxSize
+                // large, so they can join it when they are freed.
+                auto [blk, err] = allocate_aligned(parent, MaxSize, alignment);
+                if (err != error::no_error)
+                    return {{nullptr, 0}, err};
+
+                blk.size = allocation_size;
+                return {blk, error::no_error};
+            }
+
+            ret<block,error> allocate_all()
+            {
+                return parent.allocate_all();
+            }
+
+            /**
+             * @brief
+             * Hand out the cached blocks first and get the rest from the parent
+             * in a single batch, see `memory::allocate_batch()`.
+             */
+            ret<size_t,error> allocate_batch(size_t allocation_size, size_t block_count, block *out)
+            {
+                if (in_window(allocation_size) == false)
+                    return memory::allocate_batch(parent, allocation_size, block_count, out);
+
+                size_t cached_count = 0;
+
+                for (; cached_count < block_count && root != nullptr; cached_count++) {
+                    out[cached_count] = {root, allocation_size};
+                    root = root->next;
+                }
+
+                count -= cached_count;
+                if (count < idle)
+                    idle = count;
+
+                if (cached_count == block_count)
+                    return {block_count, error::no_error};
+
+                auto [allocated, err] = memory::allocate_batch(parent, MaxSize, block_count - cached_count, out + cached_count);
+
+                for (size_t i=cached_count; i<cached_count + allocated; i++)
+                    out[i].size = allocation_size;
+
+                return {cached_count + allocated, err};
+            }
+
+            error deallocate(block allocated_block)
+            {
+                if (allocated_block.ptr == nullptr)
+                    return error::null_pointer;
+
+                if (in_window(allocated_block.size) == false)
+                    return parent.deallocate(allocated_block);
+
+                if (count >= MaxCached)
+                    return parent.deallocate({allocated_block.ptr, MaxSize});
+
+                node *n = (node*)allocated_block.ptr;
+                n->next = root;
+                root = n;
+                count++;
+
+                // Reading the clock on every call would cost more than the list
+                if (++deallocations % 256 == 0 && decay.elapsed())
+                    purge_idle();
+
+                return error::no_error;
+            }
+
+            /**
+             * @brief
+             * Cache the blocks of the window and give the others to the parent,
+             * see `memory::deallocate_batch()`.
+             */
+            error deallocate_batch(block *blocks, size_t block_count)
+            {
+                error result = error::no_error;
+                size_t pushed = 0;
+
+                for (size_t i=0; i<block_count; i++) {
+                    error err = error::no_error;
+
+                    if (blocks[i].ptr == nullptr) {
+                        err = error::null_pointer;
+                    } else if (in_window(blocks[i].size) == false) {
+                        err = parent.deallocate(blocks[i]);
+                    } else if (count >= MaxCached) {
+                        err = parent.deallocate({blocks[i].ptr, MaxSize});
+                    } else {
+                        node *n = (node*)blocks[i].ptr;
+                        n->next = root;
+                        root = n;
+                        count++;
+                        pushed++;
+                    }
+
+                    if (result == error::no_error)
+                        result = err;
+                }
+
+                size_t previous = deallocations;
+                deallocations += pushed;
+
+                if (previous / 256 != deallocations / 256 && decay.elapsed())
+                    purge_idle();
+
+                return result;
+            }
+
+            error deallocate_all()
+            {
+                release_cached();
+                return parent.deallocate_all();
+            }
+
+            error expand(block& allocated_block, size_t delta)
+            {
+                if (allocated_block.ptr == nullptr)
+                    return error::null_pointer;
+
+                // A block below the window must not grow into it, otherwise it
+                // would be cached as a MaxSize block later.
+                if (allocated_block.size < MinSize && allocated_block.size + delta >= MinSize)
+                    return error::allocation_failure;
+
+                if (in_window(allocated_block.size) == false)
+                    return parent.expand(allocated_block, delta);
+
+                // Blocks in the window are MaxSize bytes large, so they can
+                // grow up to that size without moving.
+                if (allocated_block.size + delta > MaxSize)
+                    return error::allocation_failure;
+
+                allocated_block.size += delta;
+                return error::no_error;
+            }
+
+            ret<bool,error> owns(block mem_block)
+            {
+                if (in_window(mem_block.size))
+                    return parent.owns({mem_block.ptr, MaxSize});
+
+                return parent.owns(mem_block);
+            }
+
+            /**
+             * @brief
+             * Get the number of blocks currently cached in the list.
+             */
+            size_t cached() const
+            {
+                return count;
+            }
+
+            /**
+             * @brief
+             * Give the pages of the cached blocks back to the kernel, then
+             * purge the parent.
+             * 
+             * @return size_t The number of bytes given back.
+             */
+            size_t purge()
+            {
+                return purge_blocks(root, count) + memory::purge(parent);
+            }
+
+            /**
+             * @brief
+             * Give the cached blocks back to the parent, then shrink the parent.
+             * Parents that cannot reuse freed blocks, such as regions, are
+             * better off with `purge()`.
+             * 
+             * @return size_t The number of bytes given back.
+             */
+            size_t shrink()
+            {
+                size_t released = count * MaxSize;
+                release_cached();
+
+                return released + memory::shrink(parent);
+            }
+
+        private:
+            static constexpr bool in_window(size_t size)
+            {
+                return size >= MinSize && size <= MaxSize;
+            }
+
+            static size_t purge_blocks(node *n, size_t blocks)
+            {
+                // Smaller blocks hold no page besides the one of their link
+                if (MaxSize <= page_size())
+                    return 0;
+
+                size_t total = 0;
+
+                for (size_t i=0; i<blocks && n != nullptr; i++, n = n->next)
+                    total += purge_pages(n + 1, MaxSize - sizeof(node));
+
+                return total;
+            }
+
+            void purge_idle()
+            {
+                // The blocks at the bottom of the list were not reused since the
+                // last period, the list never went below them.
+                node *n = root;
+
+                for (size_t i=idle; i<count; i++)
+                    n = n->next;
+
+                purge_blocks(n, idle);
+                idle = count;
+            }
+
+            void release_cached()
+            {
+                while (root != nullptr) {
+                    node *next = root->next;
+                    parent.deallocate({root, MaxSize});
+                    root = next;
+                }
+
+                count = 0;
+                idle  = 0;
+            }
+        };
+
+        /**
+         * @brief
+         * Allocates from the primary allocator and falls back to the second one
+         * when the primary fails.
+         * 
+         * @details
+         * Deallocation and expansion are routed with `Primary::owns()`, so the
+         * primary must be able to recognise its own blocks. A stack allocator
+         * that spills over to the heap is composed as follow:
+         * ```C++
+         *      memory::fallback_allocator<memory::stack_allocator<4096>,
+         *                                 memory::heap_allocator> allocator;
+         * ```
+         * 
+         * @tparam Primary  The allocator tried first.
+         * @tparam Fallback The allocator used when the primary fails.
+         */
+        template<typename Primary, typename Fallback>
+        class fallback_allocator
+        {
+            Primary  primary;
+            Fallback fallback;
+
+        public:
+            using primary_type  = Primary;
+            using fallback_type = Fallback;
+
+            static constexpr bool thread_safe = is_thread_safe_allocator<Primary> && is_thread_safe_allocator<Fallback>;
+
+            ret<block,error> allocate(size_t allocation_size)
+            {
+                auto [blk, err] = primary.allocate(allocation_size);
+                if (err == error::no_error)
+                    return {blk, err};
+
+                return fallback.allocate(allocation_size);
+            }
+
+            ret<block,error> allocate(size_t allocation_size, size_t alignment)
+            {
+                auto [blk, err] = allocate_aligned(primary, allocation_size, alignment);
+                if (err == error::no_error)
+                    return {blk, err};
+
+                return allocate_aligned(fallback, allocation_size, alignment);
+            }
+
+            ret<block,error> allocate_all()
+            {
+                auto [blk, err] = primary.allocate_all();
+                if (err == error::no_error)
+                    return {blk, err};
+
+                return fallback.allocate_all();
+            }
+
+            error deallocate(block allocated_block)
+            {
+                if (allocated_block.ptr == nullptr)
+                    return error::null_pointer;
+
+                auto [owned, err] = primary.owns(allocated_block);
+                if (owned)
+                    return primary.deallocate(allocated_block);
+
+                return fallback.deallocate(allocated_block);
+            }
+
+            error deallocate_all()
+            {
+                auto err = primary.deallocate_all();
+                auto fallback_err = fallback.deallocate_all();
+
+                return err != error::no_error ? err : fallback_err;
+            }
+
+            error expand(block& allocated_block, size_t delta)
+            {
+                if (allocated_block.ptr == nullptr)
+                    return error::null_pointer;
+
+                auto [owned, err] = primary.owns(allocated_block);
+                if (owned)
+                    return primary.expand(allocated_block, delta);
+
+                return fallback.expand(allocated_block, delta);
+            }
+
+            ret<bool,error> owns(block mem_block)
+            {
+                auto [owned, err] = primary.owns(mem_block);
+                if (owned)
+                    return {true, error::no_error};
+
+                return fallback.owns(mem_block);
+            }
+
+            /**
+             * @brief
+             * Purge both allocators, see `memory::purge()`.
+             */
+            size_t purge()
+            {
+                return memory::purge(primary) + memory::purge(fallback);
+            }
+
+            /**
+             * @brief
+             * Shrink both allocators, see `memory::shrink()`.
+             */
+            size_t shrink()
+            {
+                return memory::shrink(primary) + memory::shrink(fallback);
+            }
+
+            Primary& get_primary() { return primary; }
+            Fallback& get_fallback() { return fallback; }
+        };
+
+        /**
+         * @brief
+         * Routes requests to one of two allocators by their size.
+         * 
+         * @details
+         * Requests of up to `Threshold` bytes go to `Small`, larger ones go to
+         * `Large`. The size of the block is enough to route deallocation, so
+         * neither allocator needs to implement `owns()`. A block cannot be
+         * expanded across the threshold because that would change its owner.
+         * 
+         * ```C++
+         *      memory::segregator<256,
+         *                         memory::freelist<memory::heap_allocator, 1, 256, 1024>,
+         *                         memory::heap_allocator> allocator;
+         * ```
+         * 
+         * @tparam Threshold The largest request served by `Small`.
+         * @tparam Small     The allocator for requests up to the threshold.
+         * @tparam Large     The allocator for requests above the threshold.
+         */
+        template<size_t Threshold, typename Small, typename Large>
+        class segregator
+        {
+            Small small;
+            Large large;
+
+        public:
+            using small_type = Small;
+            using large_type = Large;
+
+            static constexpr bool thread_safe = is_thread_safe_allocator<Small> && is_thread_safe_allocator<Large>;
+
+            ret<block,error> allocate(size_t allocation_size)
+            {
+                if (allocation_size <= Threshold)
+                    return small.allocate(allocation_size);
+
+                return large.allocate(allocation_size);
+            }
+
+            ret<block,error> allocate(size_t allocation_size, size_t alignment)
+            {
+                if (allocation_size <= Threshold)
+                    return allocate_aligned(small, allocation_size, alignment);
+
+                return allocate_aligned(large, allocation_size, alignment);
+            }
+
+            ret<block,error> allocate_all()
+            {
+                return {{nullptr, 0}, error::allocation_failure};
+            }
+
+            error deallocate(block allocated_block)
+            {
+                if (allocated_block.size <= Threshold)
+                    return small.deallocate(allocated_block);
+
+                return large.deallocate(allocated_block);
+            }
+
+            /**
+             * @brief
+             * Allocate the whole batch from the allocator of its size, see
+             * `memory::allocate_batch()`.
+             */
+            ret<size_t,error> allocate_batch(size_t allocation_size, size_t count, block *out)
+            {
+                if (allocation_size <= Threshold)
+                    return memory::allocate_batch(small, allocation_size, count, out);
+
+                return memory::allocate_batch(large, allocation_size, count, out);
+            }
+
+            /**
+             * @brief
+             * Deallocate runs of blocks on the same side of the threshold in
+             * batches, see `memory::deallocate_batch()`.
+             */
+            error deallocate_batch(block *blocks, size_t count)
+            {
+                error result = error::no_error;
+
+                for (size_t i=0, j; i<count; i = j) {
+                    bool is_small = blocks[i].size <= Threshold;
+
+                    for (j = i + 1; j < count && (blocks[j].size <= Threshold) == is_small; j++)
+                        ;
+
+                    auto err = is_small ? memory::deallocate_batch(small, blocks + i, j - i)
+                                        : memory::deallocate_batch(large, blocks + i, j - i);
+
+                    if (result == error::no_error)
+                        result = err;
+                }
+
+                return result;
+            }
+
+            error deallocate_all()
+            {
+                auto err = small.deallocate_all();
+                auto large_err = large.deallocate_all();
+
+                return err != error::no_error ? err : large_err;
+            }
+
+            error expand(block& allocated_block, size_t delta)
+            {
+                if (allocated_block.size > Threshold)
+                    return large.expand(allocated_block, delta);
+
+                if (allocated_block.size + delta > Threshold)
+                    return error::allocation_failure;
+
+                return small.expand(allocated_block, delta);
+            }
+
+            ret<bool,error> owns(block mem_block)
+            {
+                if (mem_block.size <= Threshold)
+                    return small.owns(mem_block);
+
+                return large.owns(mem_block);
+            }
+
+            /**
+             * @brief
+             * Purge both allocators, see `memory::purge()`.
+             */
+            size_t purge()
+            {
+                return memory::purge(small) + memory::purge(large);
+            }
+
+            /**
+             * @brief
+             * Shrink both allocators, see `memory::shrink()`.
+             */
+            size_t shrink()
+            {
+                return memory::shrink(small) + memory::shrink(large);
+            }
+
+            Small& get_small() { return small; }
+            Large& get_large() { return large; }
+        };
+
+        /**
+         * @brief
+         * Keeps one child allocator per size class and dispatches requests to
+         * them in constant time.
+         * 
+         * @details
+         * The range (`Min`, `Max`] is split into size classes of `Step` bytes.
+         * Class i serves requests of (`Min + i*Step`, `Min + (i+1)*Step`] bytes
+         * from an `Allocator<Min + i*Step + 1, Min + (i+1)*Step>`, so every child
+         * knows the bounds of its class. Requests outside of the range fail,
+         * compose the bucketizer with a `segregator` to handle them.
+         * 
+         * Pooling every size class with a freelist looks as follow:
+         * ```C++
+         *      template<size_t Lo, size_t Hi>
+         *      using pool = memory::freelist<memory::heap_allocator, Lo, Hi, 1024>;
+         * 
+         *      memory::bucketizer<pool, 0, 256, 16> allocator;
+         * ```
+         * 
+         * @tparam Allocator The child allocator template, parameterised by the
+         *                   smallest and largest size of its class.
+         * @tparam Min       The exclusive lower bound of the range.
+         * @tparam Max       The inclusive upper bound of the range.
+         * @tparam Step      The width of every size class.
+         */
+        template<template<size_t, size_t> class Allocator, size_t Min, size_t Max, size_t Step>
+        class bucketizer
+        {
+            static_assert(Step > 0, "Step must be larger than 0");
+            static_assert(Min < Max, "Min must be smaller than Max");
+            static_assert((Max - Min) % Step == 0, "The range must be a multiple of Step");
+
+        public:
+            /**
+             * The number of size classes.
+             */
+            static constexpr size_t bucket_count = (Max - Min) / Step;
+
+            template<size_t I>
+            using bucket_type = Allocator<Min + I*Step + 1, Min + (I+1)*Step>;
+
+            static constexpr bool thread_safe = is_thread_safe_allocator<bucket_type<0>>;
+
+        private:
+            template<typename Sequence>
+            struct bucket_tuple;
+
+            template<size_t... I>
+            struct bucket_tuple<std::index_sequence<I...>>
+            {
+                using type = std::tuple<bucket_type<I>...>;
+            };
+
+            typename bucket_tuple<std::make_index_sequence<bucket_count>>::type buckets;
+
+        public:
+            ret<block,error> allocate(size_t allocation_size)
+            {
+                if (in_range(allocation_size) == false)
+                    return {{nullptr, 0}, error::allocation_failure};
+
+                return visit(bucket_index(allocation_size), [allocation_size](auto& bucket) {
+                    return bucket.allocate(allocation_size);
+                });
+            }
+
+            ret<block,error> allocate(size_t allocation_size, size_t alignment)
+            {
+                if (in_range(allocation_size) == false)
+                    return {{nullptr, 0}, error::allocation_failure};
+
+                return visit(bucket_index(allocation_size), [allocation_size, alignment](auto& bucket) {
+                    return allocate_aligned(bucket, allocation_size, alignment);
+                });
+            }
+
+            ret<block,error> allocate_all()
+            {
+                return {{nullptr, 0}, error::allocation_failure};
+            }
+
+            error deallocate(block allocated_block)
+            {
+                if (allocated_block.ptr == nullptr)
+                    return error::null_pointer;
+
+                if (in_range(allocated_block.size) == false)
+                    return error::invalid_argument;
+
+                return visit(bucket_index(allocated_block.size), [allocated_block](auto& bucket) {
+                    return bucket.deallocate(allocated_block);
+                });
+            }
+
+            /**
+             * @brief
+             * Allocate the whole batch from the child of its size class, see
+             * `memory::allocate_batch()`.
+             */
+            ret<size_t,error> allocate_batch(size_t allocation_size, size_t count, block *out)
+            {
+                if (in_range(allocation_size) == false)
+                    return {0, error::allocation_failure};
+
+                return visit(bucket_index(allocation_size), [allocation_size, count, out](auto& bucket) {
+                    return memory::allocate_batch(bucket, allocation_size, count, out);
+                });
+            }
+
+            /**
+             * @brief
+             * Deallocate runs of blocks of the same size class in batches, see
+             * `memory::deallocate_batch()`.
+             */
+            error deallocate_batch(block *blocks, size_t count)
+            {
+                error result = error::no_error;
+
+                for (size_t i=0, j; i<count; i = j) {
+                    j = i + 1;
+
+                    if (blocks[i].ptr == nullptr || in_range(blocks[i].size) == false) {
+                        update_error(result, blocks[i].ptr == nullptr ? error::null_pointer : error::invalid_argument);
+                        continue;
+                    }
+
+                    size_t index = bucket_index(blocks[i].size);
+
+                    while (j < count && blocks[j].ptr != nullptr && in_range(blocks[j].size) &&
+                           bucket_index(blocks[j].size) == index)
+                        j++;
+
+                    update_error(result, visit(index, [run = blocks + i, length = j - i](auto& bucket) {
+                        return memory::deallocate_batch(bucket, run, length);
+                    }));
+                }
+
+                return result;
+            }
+
+            error deallocate_all()
+            {
+                error result = error::no_error;
+
+                std::apply([&result](auto&... bucket) {
+                    ((update_error(result, bucket.deallocate_all())), ...);
+                }, buckets);
+
+                return result;
+            }
+
+            error expand(block& allocated_block, size_t delta)
+            {
+                if (allocated_block.ptr == nullptr)
+                    return error::null_pointer;
+
+                if (in_range(allocated_block.size) == false)
+                    return error::invalid_argument;
+
+                // A block cannot leave its size class without changing owner
+                size_t index = bucket_index(allocated_block.size);
+                if (bucket_index(allocated_block.size + delta) != index)
+                    return error::allocation_failure;
+
+                return visit(index, [&allocated_block, delta](auto& bucket) {
+                    return bucket.expand(allocated_block, delta);
+                });
+            }
+
+            ret<bool,error> owns(block mem_block)
+            {
+                if (in_range(mem_block.size) == false)
+                    return {false, error::no_error};
+
+                return visit(bucket_index(mem_block.size), [mem_block](auto& bucket) {
+                    return bucket.owns(mem_block);
+                });
+            }
+
+            /**
+             * @brief
+             * Purge the child allocator of every size class.
+             */
+            size_t purge()
+            {
+                return std::apply([](auto&... bucket) {
+                    return (memory::purge(bucket) + ...);
+                }, buckets);
+            }
+
+            /**
+             * @brief
+             * Shrink the child allocator of every size class.
+             */
+            size_t shrink()
+            {
+                return std::apply([](auto&... bucket) {
+                    return (memory::shrink(bucket) + ...);
+                }, buckets);
+            }
+
+            /**
+             * @brief
+             * Get the child allocator of size class I.
+             */
+            template<size_t I>
+            bucket_type<I>& get_bucket()
+            {
+                return std::get<I>(buckets);
+            }
+
+        private:
+            static constexpr bool in_range(size_t size)
+            {
+                return size > Min && size <= Max;
+            }
+
+            static constexpr size_t bucket_index(size_t size)
+            {
+                return (size - Min - 1) / Step;
+            }
+
+            static void update_error(error& result, error err)
+            {
+                if (result == error::no_error)
+                    result = err;
+            }
+
+            template<size_t I, typename F>
+            static auto call_bucket(bucketizer& self, F& function)
+            {
+                return function(std::get<I>(self.buckets));
+            }
+
+            template<typename F, size_t... I>
+            auto visit(size_t index, F function, std::index_sequence<I...>)
+            {
+                using result_type = decltype(function(std::get<0>(buckets)));
+                using call_type   = result_type (*)(bucketizer&, F&);
+
+                static constexpr call_type table[] = { &call_bucket<I, F>... };
+
+                return table[index](*this, function);
+            }
+
+            template<typename F>
+            auto visit(size_t index, F function)
+            {
+                return visit(index, function, std::make_index_sequence<bucket_count>());
+            }
+        };
+
+        /**
+         * @brief
+         * Front end that caches free blocks per thread and size class, and
+         * exchanges them with a shared parent allocator in batches.
+         * 
+         * @details
+         * Requests of up to `MaxSize` bytes are rounded up to a multiple of
+         * `default_alignment` and served from the calling thread's magazine for
+         * that size class without any locking. An empty magazine is refilled
+         * with `BatchSize` blocks from the parent under a single lock, and a
+         * magazine holding `2*BatchSize` blocks flushes `BatchSize` of them back.
+         * Larger requests go to the parent directly. Blocks may be freed on any
+         * thread, they simply join the magazine of the freeing thread.
+         * 
+         * The parent and the magazines belong to the type, not to the instance.
+         * Every instance of the same `thread_cache_allocator` shares them, which
+         * lets `make_object()` and friends default-construct the allocator on
+         * every call. A thread's magazines are flushed to the parent when the
+         * thread exits.
+         * 
+         * ```C++
+         *      using global = memory::thread_cache_allocator<memory::heap_allocator>;
+         *      auto obj = make_object<session, default_dltr<session>, global>();
+         * ```
+         * 
+         * @tparam Parent    The shared allocator. It is only accessed under a lock.
+         * @tparam MaxSize   The largest request served from the magazines.
+         * @tparam BatchSize The number of blocks moved from or to the parent at once.
+         */
+        template<typename Parent, size_t MaxSize = 256, size_t BatchSize = 32>
+        class thread_cache_allocator
+        {
+            static_assert(MaxSize % default_alignment == 0, "MaxSize must be a multiple of default_alignment");
+            static_assert(BatchSize > 0, "BatchSize must be larger than 0");
+
+            static constexpr size_t class_count = MaxSize / default_alignment;
+
+            struct node
+            {
+                node *next;
+            };
+
+            struct magazine
+            {
+                node   *root  = nullptr;
+                size_t  count = 0;
+            };
+
+            struct shared_state
+            {
+                std::mutex lock;
+                Parent     parent;
+            };
+
+            struct thread_cache
+            {
+                magazine magazines[class_count];
+
+                ~thread_cache()
+                {
+                    for (size_t i=0; i<class_count; i++)
+                        flush(magazines[i], i, magazines[i].count);
+                }
+            };
+
+        public:
+            using parent_type = Parent;
+
+            ret<block,error> allocate(size_t allocation_size)
+            {
+                if (allocation_size == 0)
+                    return {{nullptr, 0}, error::invalid_argument};
+
+                if (allocation_size > MaxSize) {
+                    std::lock_guard<std::mutex> guard(shared().lock);
+                    return shared().parent.allocate(allocation_size);
+                }
+
+                size_t index = class_index(allocation_size);
+                magazine& mag = local().magazines[index];
+
+                if (mag.root == nullptr) {
+                    auto err = refill(mag, index);
+                    if (err != error::no_error)
+                        return {{nullptr, 0}, err};
+                }
+
+                node *n = mag.root;
+                mag.root = n->next;
+                mag.count--;
+
+                return {{n, allocation_size}, error::no_error};
+            }
+
+            ret<block,error> allocate(size_t allocation_size, size_t alignment)
+            {
+                if (alignment <= default_alignment)
+                    return allocate(allocation_size);
+
+                if (allocation_size == 0 || is_power_of_two(alignment) == false)
+                    return {{nullptr, 0}, error::invalid_argument};
+
+                // Over-aligned blocks come from the parent but are as large as
+                // their size class, so they can join the magazines when freed.
+                size_t size = allocation_size > MaxSize ? allocation_size
+                                                        : class_size(class_index(allocation_size));
+
+                std::lock_guard<std::mutex> guard(shared().lock);
+                auto [blk, err] = allocate_aligned(shared().parent, size, alignment);
+                if (err != error::no_error)
+                    return {{nullptr, 0}, err};
+
+                blk.size = allocation_size;
+                return {blk, error::no_error};
+            }
+
+            ret<block,error> allocate_all()
+            {
+                return {{nullptr, 0}, error::allocation_failure};
+            }
+
+            error deallocate(block allocated_block)
+            {
+                if (allocated_block.ptr == nullptr)
+                    return error::null_pointer;
+
+                if (allocated_block.size > MaxSize) {
+                    std::lock_guard<std::mutex> guard(shared().lock);
+                    return shared().parent.deallocate(allocated_block);
+                }
+
+                size_t index = class_index(allocated_block.size);
+                magazine& mag = local().magazines[index];
+
+                node *n = (node*)allocated_block.ptr;
+                n->next = mag.root;
+                mag.root = n;
+                mag.count++;
+
+                if (mag.count >= 2*BatchSize)
+                    flush(mag, index, BatchSize);
+
+                return error::no_error;
+            }
+
+            /**
+             * @brief
+             * Hand out count blocks from the calling thread's magazine, refilling
+             * it as needed, see `memory::allocate_batch()`. Larger requests go
+             * to the parent in a single batch under one lock.
+             */
+            ret<size_t,error> allocate_batch(size_t allocation_size, size_t count, block *out)
+            {
+                if (allocation_size == 0)
+                    return {0, error::invalid_argument};
+
+                if (allocation_size > MaxSize) {
+                    std::lock_guard<std::mutex> guard(shared().lock);
+                    return memory::allocate_batch(shared().parent, allocation_size, count, out);
+                }
+
+                size_t index = class_index(allocation_size);
+                magazine& mag = local().magazines[index];
+
+                for (size_t i=0; i<count; i++) {
+                    if (mag.root == nullptr) {
+                        auto err = refill(mag, index);
+                        if (err != error::no_error)
+                            return {i, err};
+                    }
+
+                    node *n = mag.root;
+                    mag.root = n->next;
+                    mag.count--;
+
+                    out[i] = {n, allocation_size};
+                }
+
+                return {count, error::no_error};
+            }
+
+            /**
+             * @brief
+             * The blocks cached by other threads cannot be reclaimed safely,
+             * hence this always fails. Use `flush()` to return the calling
+             * thread's blocks to the parent.
+             */
+            error deallocate_all()
+            {
+                return error::deallocation_failure;
+            }
+
+            error expand(block& allocated_block, size_t delta)
+            {
+                if (allocated_block.ptr == nullptr)
+                    return error::null_pointer;
+
+                if (allocated_block.size > MaxSize) {
+                    std::lock_guard<std::mutex> guard(shared().lock);
+                    return shared().parent.expand(allocated_block, delta);
+                }
+
+                // Blocks are as large as their size class
+                size_t index = class_index(allocated_block.size);
+                if (allocated_block.size + delta > class_size(index))
+                    return error::allocation_failure;
+
+                allocated_block.size += delta;
+                return error::no_error;
+            }
+
+            ret<bool,error> owns(block mem_block)
+            {
+                std::lock_guard<std::mutex> guard(shared().lock);
+
+                if (mem_block.size > 0 && mem_block.size <= MaxSize)
+                    return shared().parent.owns({mem_block.ptr, class_size(class_index(mem_block.size))});
+
+                return shared().parent.owns(mem_block);
+            }
+
+            /**
+             * @brief
+             * Return every block cached by the calling thread to the parent.
+             */
+            void flush()
+            {
+                thread_cache& cache = local();
+
+                for (size_t i=0; i<class_count; i++)
+                    flush(cache.magazines[i], i, cache.magazines[i].count);
+            }
+
+            /**
+             * @brief
+             * Return the calling thread's blocks to the parent, then purge the
+             * parent under its lock. The magazines of other threads are left
+             * alone.
+             */
+            size_t purge()
+            {
+                flush();
+
+                std::lock_guard<std::mutex> guard(shared().lock);
+                return memory::purge(shared().parent);
+            }
+
+            /**
+             * @brief
+             * Return the calling thread's blocks to the parent, then shrink the
+             * parent under its lock. The magazines of other threads are left
+             * alone.
+             */
+            size_t shrink()
+            {
+                flush();
+
+                std::lock_guard<std::mutex> guard(shared().lock);
+                return memory::shrink(shared().parent);
+            }
+
+            /**
+             * @brief
+             * Take the lock of the shared parent, i.e. in a `pthread_atfork()`
+             * prepare handler so that no other thread holds it while `fork()`
+             * copies the process. Release it with `unlock_parent()`.
+             */
+            static void lock_parent()
+            {
+                shared().lock.lock();
+            }
+
+            /**
+             * @brief
+             * Release the lock taken by `lock_parent()`. In the child of a
+             * `fork()` the forking thread still owns it and may release it.
+             */
+            static void unlock_parent()
+            {
+                shared().lock.unlock();
+            }
+
+            /**
+             * @brief
+             * Get the number of blocks cached by the calling thread.
+             */
+            size_t cached() const
+            {
+                size_t total = 0;
+                thread_cache& cache = local();
+
+                for (size_t i=0; i<class_count; i++)
+                    total += cache.magazines[i].count;
+
+                return total;
+            }
+
+        private:
+            static constexpr size_t class_index(size_t size)
+            {
+                return (size - 1) / default_alignment;
+            }
+
+            static constexpr size_t class_size(size_t index)
+            {
+                return (index + 1) * default_alignment;
+            }
+
+            static shared_state& shared()
+            {
+                static shared_state state;
+                return state;
+            }
+
+            static thread_cache& local()
+            {
+                thread_local thread_cache cache;
+                return cache;
+            }
+
+            static error refill(magazine& mag, size_t index)
+            {
+                block blocks[BatchSize];
+                size_t allocated = 0;
+                error err = error::no_error;
+
+                {
+                    std::lock_guard<std::mutex> guard(shared().lock);
+                    std::tie(allocated, err) = memory::allocate_batch(shared().parent, class_size(index), BatchSize, blocks);
+                }
+
+                for (size_t i=0; i<allocated; i++) {
+                    node *n = (node*)blocks[i].ptr;
+                    n->next = mag.root;
+                    mag.root = n;
+                    mag.count++;
+                }
+
+                return mag.count > 0 ? error::no_error : err;
+            }
+
+            static void flush(magazine& mag, size_t index, size_t count)
+            {
+                if (count == 0)
+                    return;
+
+                block blocks[BatchSize];
+                std::lock_guard<std::mutex> guard(shared().lock);
+
+                while (count > 0 && mag.root != nullptr) {
+                    size_t length = 0;
+
+                    for (; length < BatchSize && length < count && mag.root != nullptr; length++) {
+                        blocks[length] = {mag.root, class_size(index)};
+                        mag.root = mag.root->next;
+                        mag.count--;
+                    }
+
+                    memory::deallocate_batch(shared().parent, blocks, length);
+                    count -= length;
+                }
+            }
+        };
+
+        /**
+         * @brief
+         * Lock-free pool of fixed size blocks that can be freed from any thread.
+         * 
+         * @details
+         * The pool carves blocks of `BlockSize` bytes out of chunks of
+         * `ChunkSize` bytes. Free blocks are kept in a Treiber stack. Its head
+         * packs a 32 bit block index with a 32 bit tag that is bumped on every
+         * update, so a 64 bit compare-and-swap is enough to rule out the ABA
+         * problem. Chunks are aligned to their size, which maps a block back to
+         * its index in constant time. Chunks are never returned to the system
+         * while the pool is alive, hence reading the link of a block that was
+         * just popped by another thread is always safe.
+         * 
+         * Like `thread_cache_allocator`, the pool belongs to the type so that it
+         * can be default-constructed by `make_object()` on one thread and
+         * released by `destroy_smart_ptr()` on another.
+         * 
+         * ```C++
+         *      memory::concurrent_pool<sizeof(ref_counter) + sizeof(session)> pool;
+         *      auto [blk, err] = pool.allocate(sizeof(ref_counter) + sizeof(session));
+         * ```
+         * 
+         * @tparam BlockSize The size of every block.
+         * @tparam ChunkSize The size of the chunks reserved from the heap. It
+         *                   must be a power of two.
+         * @tparam MaxChunks The maximum number of chunks.
+         */
+        template<size_t BlockSize, size_t ChunkSize = 64 * 1024, size_t MaxChunks = 1024>
+        class concurrent_pool
+        {
+            struct node
+            {
+                std::atomic_uint32_t next;
+            };
+
+            struct chunk_header
+            {
+                uint32_t number;
+            };
+
+            static constexpr size_t block_size  = align_up(BlockSize < sizeof(node) ? sizeof(node) : BlockSize,
+                                                           default_alignment);
+            static constexpr size_t header_size = align_up(sizeof(chunk_header), default_alignment);
+
+            static_assert((ChunkSize & (ChunkSize - 1)) == 0, "ChunkSize must be a power of two");
+            static_assert(ChunkSize >= header_size + block_size, "ChunkSize must hold at least one block");
+
+        public:
+            /**
+             * The number of blocks carved from every chunk.
+             */
+            static constexpr size_t blocks_per_chunk = (ChunkSize - header_size) / block_size;
+
+        private:
+            static constexpr uint32_t empty = UINT32_MAX;
+
+            static_assert((uint64_t)blocks_per_chunk * MaxChunks < empty, "Too many blocks to index");
+
+            struct shared_state
+            {
+                std::atomic_uint64_t head;
+                std::atomic_size_t   chunk_count;
+                std::atomic<char*>   chunks[MaxChunks];
+
+                shared_state() : head(pack(empty, 0)), chunk_count(0)
+                {
+                    for (size_t i=0; i<MaxChunks; i++)
+                        chunks[i].store(nullptr);
+                }
+
+                ~shared_state()
+                {
+                    size_t count = chunk_count.load();
+                    for (size_t i=0; i<count && i<MaxChunks; i++)
+                        free(chunks[i].load());
+                }
+            };
+
+        public:
+            ret<block,error> allocate(size_t allocation_size)
+            {
+                if (allocation_size == 0)
+                    return {{nullptr, 0}, error::invalid_argument};
+
+                if (allocation_size > block_size)
+                    return {{nullptr, 0}, error::allocation_failure};
+
+                shared_state& s = shared();
+                uint64_t old_head = s.head.load(std::memory_order_acquire);
+
+                while (head_index(old_head) != empty) {
+                    node *n = (node*)address(head_index(old_head));
+                    uint32_t next = n->next.load(std::memory_order_relaxed);
+
+                    // A stale next is harmless, the tag makes the exchange fail.
+                    if (s.head.compare_exchange_weak(old_head, pack(next, head_tag(old_head) + 1),
+                                                     std::memory_order_acq_rel,
+                                                     std::memory_order_acquire))
+                        return {{n, allocation_size}, error::no_error};
+                }
+
+                auto [ptr, err] = grow();
+                if (err != error::no_error)
+                    return {{nullptr, 0}, err};
+
+                return {{ptr, allocation_size}, error::no_error};
+            }
+
+            /**
+             * @brief
+             * Blocks are aligned to `default_alignment`, larger alignments are
+             * not supported.
+             */
+            ret<block,error> allocate(size_t allocation_size, size_t alignment)
+            {
+                if (is_power_of_two(alignment) == false)
+                    return {{nullptr, 0}, error::invalid_argument};
+
+                if (alignment > default_alignment)
+                    return {{nullptr, 0}, error::allocation_failure};
+
+                return allocate(allocation_size);
+            }
+
+            ret<block,error> allocate_all()
+            {
+                return {{nullptr, 0}, error::allocation_failure};
+            }
+
+            error deallocate(block allocated_block)
+            {
+                if (allocated_block.ptr == nullptr)
+                    return error::null_pointer;
+
+                if (allocated_block.size > block_size)
+                    return error::invalid_argument;
+
+                uint32_t index = block_index((char*)allocated_block.ptr);
+                node *n = new (allocated_block.ptr) node;
+
+                push(n, index);
+
+                return error::no_error;
+            }
+
+            /**
+             * @brief
+             * The pool cannot tell which blocks are still in use, hence this
+             * always fails. Chunks are freed when the program exits.
+             */
+            error deallocate_all()
+            {
+                return error::deallocation_failure;
+            }
+
+            error expand(block& allocated_block, size_t delta)
+            {
+                if (allocated_block.ptr == nullptr)
+                    return error::null_pointer;
+
+                if (allocated_block.size + delta > block_size)
+                    return error::allocation_failure;
+
+                allocated_block.size += delta;
+                return error::no_error;
+            }
+
+            ret<bool,error> owns(block mem_block)
+            {
+                shared_state& s = shared();
+                char *ptr = (char*)mem_block.ptr;
+                size_t count = s.chunk_count.load(std::memory_order_acquire);
+
+                for (size_t i=0; i<count && i<MaxChunks; i++) {
+                    char *chunk = s.chunks[i].load(std::memory_order_acquire);
+
+                    if (chunk != nullptr && ptr >= chunk + header_size && ptr < chunk + ChunkSize)
+                        return {true, error::no_error};
+                }
+
+                return {false, error::no_error};
+            }
+
+        private:
+            static constexpr uint64_t pack(uint32_t index, uint32_t tag)
+            {
+                return ((uint64_t)tag << 32) | index;
+            }
+
+            static constexpr uint32_t head_index(uint64_t head)
+            {
+                return (uint32_t)head;
+            }
+
+            static constexpr uint32_t head_tag(uint64_t head)
+            {
+                return (uint32_t)(head >> 32);
+            }
+
+            static shared_state& shared()
+            {
+                static shared_state state;
+                return state;
+            }
+
+            static char *address(uint32_t index)
+            {
+                char *chunk = shared().chunks[index / blocks_per_chunk].load(std::memory_order_acquire);
+                return chunk + header_size + (index % blocks_per_chunk) * block_size;
+            }
+
+            static uint32_t block_index(char *ptr)
+            {
+                char *chunk = (char*)((uintptr_t)ptr & ~(uintptr_t)(ChunkSize - 1));
+                uint32_t number = ((chunk_header*)chunk)->number;
+
+                return number * blocks_per_chunk + (ptr - chunk - header_size) / block_size;
+            }
+
+            /**
+             * Push a chain of blocks, linked from first to last, on the free list.
+             */
+            static void push(node *last, uint32_t first)
+            {
+                shared_state& s = shared();
+                uint64_t old_head = s.head.load(std::memory_order_relaxed);
+
+                do {
+                    last->next.store(head_index(old_head), std::memory_order_relaxed);
+                } while (!s.head.compare_exchange_weak(old_head, pack(first, head_tag(old_head) + 1),
+                                                       std::memory_order_release,
+                                                       std::memory_order_relaxed));
+            }
+
+            static ret<char*,error> grow()
+            {
+                shared_state& s = shared();
+                size_t number = s.chunk_count.load(std::memory_order_relaxed);
+
+                if (number >= MaxChunks)
+                    return {nullptr, error::allocation_failure};
+
+                // The slot is claimed once the chunk is allocated, so that a
+                // failed allocation does not leave an empty slot behind.
+                char *chunk = (char*)aligned_alloc(ChunkSize, ChunkSize);
+                if (chunk == nullptr)
+                    return {nullptr, error::allocation_failure};
+
+                do {
+                    if (number >= MaxChunks) {
+                        free(chunk);
+                        return {nullptr, error::allocation_failure};
+                    }
+                } while (!s.chunk_count.compare_exchange_weak(number, number + 1));
+
+                ((chunk_header*)chunk)->number = number;
+                s.chunks[number].store(chunk, std::memory_order_release);
+
+                // Keep the first block and link the rest into a chain that is
+                // published with a single exchange.
+                uint32_t base = number * blocks_per_chunk;
+                char *blocks = chunk + header_size;
+
+                if (blocks_per_chunk > 1) {
+                    for (size_t i=1; i<blocks_per_chunk; i++) {
+                        node *n = new (blocks + i*block_size) node;
+                        n->next.store(base + i + 1, std::memory_order_relaxed);
+                    }
+
+                    node *last = (node*)(blocks + (blocks_per_chunk - 1)*block_size);
+                    push(last, base + 1);
+                }
+
+                return {blocks, error::no_error};
+            }
+        };
+
+        /**
+         * @brief
+         * Surrounds every block of the parent with a prefix and a suffix object.
+         * 
+         * @details
+         * The block handed out starts `prefix_size` bytes into the parent's
+         * block, so it keeps `default_alignment`. The prefix area ends with the
+         * alignment the block was allocated with. The suffix is placed right
+         * after the block, aligned to its own type. Use `void` to omit either
+         * of them. The prefix and suffix are default-constructed on allocation
+         * and destructed on deallocation, use `prefix()` and `suffix()` to reach
+         * them. Typical uses are per-block bookkeeping and guard words:
+         * ```C++
+         *      memory::affix_allocator<memory::heap_allocator, uint64_t, uint64_t> fenced;
+         *      auto [blk, err] = fenced.allocate(100);
+         *      *fenced.suffix(blk) = 0xfeedfacecafebeef;
+         * ```
+         * 
+         * For alignments beyond `default_alignment` the parent's block is
+         * allocated with that alignment and the prefix area is padded up to it.
+         * The recorded alignment gives the padding back, so the parent's block
+         * is found from the aligned block and moved blocks keep their alignment.
+         * 
+         * @tparam Parent The allocator to get blocks from.
+         * @tparam Prefix The type placed before every block, or void.
+         * @tparam Suffix The type placed after every block, or void. It must be
+         *                trivially copyable so it can follow a moved block.
+         */
+        template<typename Parent, typename Prefix, typename Suffix = void>
+        class affix_allocator
+        {
+            static_assert(std::is_void<Suffix>::value || std::is_trivially_copyable<Suffix>::value,
+                          "Suffix must be trivially copyable");
+
+            template<typename U>
+            static constexpr size_t size_of()
+            {
+                if constexpr (std::is_void<U>::value)
+                    return 0;
+                else
+                    return sizeof(U);
+            }
+
+            template<typename U>
+            static constexpr size_t align_of()
+            {
+                if constexpr (std::is_void<U>::value)
+                    return 1;
+                else
+                    return alignof(U);
+            }
+
+            static_assert(align_of<Prefix>() <= default_alignment, "Prefix is over-aligned");
+            static_assert(align_of<Suffix>() <= default_alignment, "Suffix is over-aligned");
+
+            Parent parent;
+
+        public:
+            using parent_type = Parent;
+
+            static constexpr bool thread_safe = is_thread_safe_allocator<Parent>;
+            using prefix_type = Prefix;
+            using suffix_type = Suffix;
+
+            /**
+             * The distance between the prefix and the block handed out. It holds
+             * the prefix and the alignment of the block.
+             */
+            static constexpr size_t prefix_size = align_up(align_up(size_of<Prefix>(), alignof(size_t)) + sizeof(size_t),
+                                                           default_alignment);
+
+            ret<block,error> allocate(size_t allocation_size)
+            {
+                return allocate(allocation_size, default_alignment);
+            }
+
+            ret<block,error> allocate(size_t allocation_size, size_t alignment)
+            {
+                if (allocation_size == 0 || is_power_of_two(alignment) == false)
+                    return {{nullptr, 0}, error::invalid_argument};
+
+                if (alignment < default_alignment)
+                    alignment = default_alignment;
+
+                size_t padding = padding_of(alignment);
+
+                auto [blk, err] = alignment > default_alignment ?
+                                  allocate_aligned(parent, padding + outer_size(allocation_size), alignment) :
+                                  parent.allocate(outer_size(allocation_size));
+
+                if (err != error::no_error)
+                    return {{nullptr, 0}, err};
+
+                block inner{(char*)blk.ptr + padding + prefix_size, allocation_size};
+                *alignment_of(inner) = alignment;
+
+                if constexpr (!std::is_void<Prefix>::value)
+                    construct(prefix(inner));
+
+                if constexpr (!std::is_void<Suffix>::value)
+                    construct(suffix(inner));
+
+                return {inner, error::no_error};
+            }
+
+            ret<block,error> allocate_all()
+            {
+                return {{nullptr, 0}, error::allocation_failure};
+            }
+
+            error deallocate(block allocated_block)
+            {
+                if (allocated_block.ptr == nullptr)
+                    return error::null_pointer;
+
+                if constexpr (!std::is_void<Prefix>::value)
+                    destruct(prefix(allocated_block));
+
+                if constexpr (!std::is_void<Suffix>::value)
+                    destruct(suffix(allocated_block));
+
+                return parent.deallocate(outer(allocated_block));
+            }
+
+            error deallocate_all()
+            {
+                return parent.deallocate_all();
+            }
+
+            error expand(block& allocated_block, size_t delta)
+            {
+                if (allocated_block.ptr == nullptr)
+                    return error::null_pointer;
+
+                block outer_block = outer(allocated_block);
+                size_t alignment  = *alignment_of(allocated_block);
+                size_t padding    = padding_of(alignment);
+                size_t new_size   = allocated_block.size + delta;
+                size_t offset     = padding + suffix_offset(allocated_block.size);
+
+                auto err = expand_aligned(parent, outer_block, outer_size(new_size) - outer_size(allocated_block.size), alignment);
+                if (err != error::no_error)
+                    return err;
+
+                // The parent may have moved the block, the suffix came along at
+                // its old offset.
+                if constexpr (!std::is_void<Suffix>::value)
+                    memmove((char*)outer_block.ptr + padding + suffix_offset(new_size),
+                            (char*)outer_block.ptr + offset, sizeof(Suffix));
+
+                allocated_block.ptr  = (char*)outer_block.ptr + padding + prefix_size;
+                allocated_block.size = new_size;
+
+                return error::no_error;
+            }
+
+            ret<bool,error> owns(block mem_block)
+            {
+                if (mem_block.ptr == nullptr)
+                    return {false, error::no_error};
+
+                return parent.owns(outer(mem_block));
+            }
+
+            /**
+             * @brief
+             * Get the prefix of a block allocated by this allocator.
+             */
+            template<typename P = Prefix>
+            static P *prefix(block mem_block)
+            {
+                return (P*)((char*)mem_block.ptr - prefix_size);
+            }
+
+            /**
+             * @brief
+             * Get the suffix of a block allocated by this allocator.
+             */
+            template<typename S = Suffix>
+            static S *suffix(block mem_block)
+            {
+                return (S*)((char*)mem_block.ptr - prefix_size + suffix_offset(mem_block.size));
+            }
+
+            Parent& get_parent() { return parent; }
+
+        private:
+            static constexpr size_t suffix_offset(size_t size)
+            {
+                return align_up(prefix_size + size, align_of<Suffix>());
+            }
+
+            static constexpr size_t outer_size(size_t size)
+            {
+                return suffix_offset(size) + size_of<Suffix>();
+            }
+
+            static constexpr size_t padding_of(size_t alignment)
+            {
+                return align_up(prefix_size, alignment) - prefix_size;
+            }
+
+            static size_t *alignment_of(block mem_block)
+            {
+                return (size_t*)((char*)mem_block.ptr - sizeof(size_t));
+            }
+
+            static block outer(block mem_block)
+            {
+                size_t padding = padding_of(*alignment_of(mem_block));
+                return {(char*)mem_block.ptr - prefix_size - padding, padding + outer_size(mem_block.size)};
+            }
+        };
+
+        /**
+         * Allocation counters of a call site, a size bucket or a whole allocator.
+         */
+        struct allocation_stats
+        {
+            size_t allocations;
+            size_t deallocations;
+            size_t live_bytes;
+            size_t peak_bytes;
+        };
+
+        /**
+         * Allocation counters of one call site.
+         */
+        struct call_site_stats
+        {
+            const void       *call_site;
+            allocation_stats  stats;
+        };
+
+        /**
+         * A copy of the counters of a `stats_allocator` at one point in time.
+         */
+        struct stats_snapshot
+        {
+            allocation_stats              total;
+            std::vector<allocation_stats> size_buckets;
+            std::vector<call_site_stats>  call_sites;
+        };
+
+        /**
+         * @brief
+         * Counts allocations, deallocations, live and peak bytes per call site
+         * and per size bucket.
+         * 
+         * @details
+         * The call site is the return address of `allocate()`. Because
+         * `make_object<T>()` and `memory::make<T>()` are instantiated per type,
+         * the call site tells which types dominate the heap. Each block carries
+         * the index of its call site in a prefix, so frees are charged to the
+         * site that allocated the block even when they happen elsewhere. Size
+         * bucket i counts blocks of [2^(i-1), 2^i) bytes. An expansion that
+         * crosses buckets counts as a free and an allocation in the buckets.
+         * 
+         * Counters are relaxed atomics and belong to the type, so wrapping the
+         * global allocator is enough to watch every `make_object()`:
+         * ```C++
+         *      namespace ltd::memory {
+         *          class global_allocator : public stats_allocator<heap_allocator> {};
+         *      }
+         *      ...
+         *      auto snapshot = memory::stats_allocator<memory::heap_allocator>::snapshot();
+         * ```
+         * 
+         * Up to `MaxCallSites` call sites are tracked, later ones are charged
+         * to a single entry with a null call site.
+         * 
+         * @tparam Parent       The allocator to get blocks from.
+         * @tparam MaxCallSites The number of call sites tracked.
+         */
+        template<typename Parent, size_t MaxCallSites = 1024>
+        class stats_allocator
+        {
+            struct site_prefix
+            {
+                uint32_t site;
+            };
+
+            struct counters
+            {
+                std::atomic_size_t allocations{0};
+                std::atomic_size_t deallocations{0};
+                std::atomic_size_t live_bytes{0};
+                std::atomic_size_t peak_bytes{0};
+
+                void on_allocate(size_t size)
+                {
+                    allocations.fetch_add(1, std::memory_order_relaxed);
+                    grow(size);
+                }
+
+                void on_deallocate(size_t size)
+                {
+                    deallocations.fetch_add(1, std::memory_order_relaxed);
+                    live_bytes.fetch_sub(size, std::memory_order_relaxed);
+                }
+
+                void grow(size_t size)
+                {
+                    size_t live = live_bytes.fetch_add(size, std::memory_order_relaxed) + size;
+                    size_t peak = peak_bytes.load(std::memory_order_relaxed);
+
+                    while (live > peak && !peak_bytes.compare_exchange_weak(peak, live, std::memory_order_relaxed))
+                        ;
+                }
+
+                allocation_stats load() const
+                {
+                    return {allocations.load(std::memory_order_relaxed),
+                            deallocations.load(std::memory_order_relaxed),
+                            live_bytes.load(std::memory_order_relaxed),
+                            peak_bytes.load(std::memory_order_relaxed)};
+                }
+            };
+
+            struct site_entry
+            {
+                std::atomic<const void*> call_site{nullptr};
+                counters                 stats;
+            };
+
+            static constexpr size_t bucket_count = sizeof(size_t) * 8 + 1;
+
+            struct shared_state
+            {
+                counters   total;
+                counters   buckets[bucket_count];
+                site_entry sites[MaxCallSites + 1];
+            };
+
+            affix_allocator<Parent, site_prefix> allocator;
+
+        public:
+            using parent_type = Parent;
+
+            static constexpr bool thread_safe = is_thread_safe_allocator<Parent>;
+
+            __attribute__((noinline)) ret<block,error> allocate(size_t allocation_size)
+            {
+                auto [blk, err] = allocator.allocate(allocation_size);
+                if (err == error::no_error)
+                    on_allocate(blk, __builtin_return_address(0));
+
+                return {blk, err};
+            }
+
+            __attribute__((noinline)) ret<block,error> allocate(size_t allocation_size, size_t alignment)
+            {
+                auto [blk, err] = allocator.allocate(allocation_size, alignment);
+                if (err == error::no_error)
+                    on_allocate(blk, __builtin_return_address(0));
+
+                return {blk, err};
+            }
+
+            ret<block,error> allocate_all()
+            {
+                return allocator.allocate_all();
+            }
+
+            error deallocate(block allocated_block)
+            {
+                if (allocated_block.ptr == nullptr)
+                    return error::null_pointer;
+
+                shared_state& s = shared();
+                uint32_t site = allocator.prefix(allocated_block)->site;
+
+                s.total.on_deallocate(allocated_block.size);
+                s.buckets[bucket_of(allocated_block.size)].on_deallocate(allocated_block.size);
+                s.sites[site].stats.on_deallocate(allocated_block.size);
+
+                return allocator.deallocate(allocated_block);
+            }
+
+            error deallocate_all()
+            {
+                return allocator.deallocate_all();
+            }
+
+            error expand(block& allocated_block, size_t delta)
+            {
+                size_t old_size = allocated_block.size;
+
+                auto err = allocator.expand(allocated_block, delta);
+                if (err != error::no_error)
+                    return err;
+
+                shared_state& s = shared();
+                uint32_t site = allocator.prefix(allocated_block)->site;
+
+                s.total.grow(delta);
+                s.sites[site].stats.grow(delta);
+
+                size_t old_bucket = bucket_of(old_size);
+                size_t new_bucket = bucket_of(allocated_block.size);
+
+                if (old_bucket == new_bucket) {
+                    s.buckets[old_bucket].grow(delta);
+                } else {
+                    s.buckets[old_bucket].on_deallocate(old_size);
+                    s.buckets[new_bucket].on_allocate(allocated_block.size);
+                }
+
+                return error::no_error;
+            }
+
+            ret<bool,error> owns(block mem_block)
+            {
+                return allocator.owns(mem_block);
+            }
+
+            /**
+             * @brief
+             * Copy the current counters.
+             * 
+             * @return stats_snapshot The totals, every size bucket and every
+             *         call site seen so far.
+             */
+            static stats_snapshot snapshot()
+            {
+                shared_state& s = shared();
+                stats_snapshot result;
+
+                result.total = s.total.load();
+
+                for (size_t i=0; i<bucket_count; i++)
+                    result.size_buckets.push_back(s.buckets[i].load());
+
+                for (size_t i=0; i<=MaxCallSites; i++) {
+                    const void *call_site = s.sites[i].call_site.load(std::memory_order_acquire);
+                    allocation_stats stats = s.sites[i].stats.load();
+
+                    if (call_site != nullptr || stats.allocations > 0)
+                        result.call_sites.push_back({call_site, stats});
+                }
+
+                return result;
+            }
+
+        private:
+            static shared_state& shared()
+            {
+                static shared_state state;
+                return state;
+            }
+
+            static size_t bucket_of(size_t size)
+            {
+                size_t bucket = 0;
+                for (; size != 0; size >>= 1)
+                    bucket++;
+
+                return bucket;
+            }
+
+            /**
+             * Find the entry of the call site, registering it when it is new.
+             */
+            static uint32_t site_of(const void *call_site)
+            {
+                shared_state& s = shared();
+                size_t start = ((uintptr_t)call_site >> 2) % MaxCallSites;
+
+                for (size_t i=0; i<MaxCallSites; i++) {
+                    size_t index = (start + i) % MaxCallSites;
+                    const void *current = s.sites[index].call_site.load(std::memory_order_acquire);
+
+                    if (current == call_site)
+                        return index;
+
+                    if (current == nullptr &&
+                        (s.sites[index].call_site.compare_exchange_strong(current, call_site,
+                                                                          std::memory_order_acq_rel)
+                         || current == call_site))
+                        return index;
+                }
+
+                return MaxCallSites;
+            }
+
+            static void on_allocate(block blk, const void *call_site)
+            {
+                shared_state& s = shared();
+                uint32_t site = site_of(call_site);
+
+                affix_allocator<Parent, site_prefix>::prefix(blk)->site = site;
+
+                s.total.on_allocate(blk.size);
+                s.buckets[bucket_of(blk.size)].on_allocate(blk.size);
+                s.sites[site].stats.on_allocate(blk.size);
+            }
+        };
+
+        /**
+         * Output formats of the heap profiler.
+         */
+        enum class heap_profile_format
+        {
+            Pprof,
+            Folded
+        };
+
+        /**
+         * A live sample of the heap profiler, opaque to the allocators.
+         */
+        struct heap_sample;
+
+        /**
+         * @brief
+         * Sampling heap profiler shared by the whole program.
+         * 
+         * @details
+         * Roughly once every `get_sample_interval()` bytes, an allocation is
+         * sampled: the stack trace and the size are recorded until the block is
+         * freed. The distance between samples is drawn from an exponential
+         * distribution, so periodic allocation patterns do not skew the profile.
+         * The other allocations only pay for a thread-local countdown.
+         * 
+         * Allocators report to the profiler through `sampling_allocator`. The
+         * live samples are written with `dump()`, either in the legacy pprof heap
+         * format, which `pprof` reads along with the binary, or as folded stacks
+         * for flame graph tools:
+         * ```C++
+         *      memory::heap_profiler::set_sample_interval(512 * 1024);
+         *      memory::heap_profiler::dump_on_signal(SIGUSR2, "/tmp/heap.prof", memory::heap_profile_format::Pprof);
+         *      ...
+         *      memory::heap_profiler::dump("/tmp/heap.folded", memory::heap_profile_format::Folded);
+         * ```
+         * 
+         * Writing a file is not safe in a signal handler, so the signal only
+         * requests a dump, written by the next call to `poll()`. Call it from
+         * the main loop or from a thread of its own: writing a dump allocates,
+         * hence allocations never write one.
+         */
+        class heap_profiler
+        {
+            static inline std::atomic_size_t interval{0};
+            static inline thread_local int64_t bytes_until_sample = 0;
+
+        public:
+            /**
+             * The deepest stack trace recorded.
+             */
+            static constexpr size_t max_frames = 32;
+
+            /**
+             * @brief
+             * Set the mean number of bytes between samples, 0 turns sampling off.
+             */
+            static void set_sample_interval(size_t bytes);
+
+            /**
+             * @brief
+             * Get the mean number of bytes between samples, 0 when off.
+             */
+            static size_t get_sample_interval();
+
+            /**
+             * @brief
+             * Account for an allocation and sample it when its turn has come.
+             * 
+             * @param size The size of the allocation.
+             * @return heap_sample* The sample to pass to `forget()` when the block
+             *         is freed, or nullptr if the allocation was not sampled.
+             */
+            static heap_sample *sample(size_t size)
+            {
+                if (interval.load(std::memory_order_relaxed) == 0)
+                    return nullptr;
+
+                bytes_until_sample -= (int64_t)size;
+                if (bytes_until_sample > 0)
+                    return nullptr;
+
+                return record(size);
+            }
+
+            /**
+             * @brief
+             * Update the size of a sampled block that was expanded.
+             */
+            static void resize(heap_sample *sample, size_t size);
+
+            /**
+             * @brief
+             * Drop the sample of a block that was freed.
+             */
+            static void forget(heap_sample *sample);
+
+            /**
+             * @brief
+             * Get the number of live samples.
+             */
+            static size_t live_samples();
+
+            /**
+             * @brief
+             * Write the live samples to a file.
+             * 
+             * @details
+             * The pprof format lists the size of every sample with its return
+             * addresses and the mappings of the process, pprof scales the sizes
+             * back by the sample interval. The folded format writes one line of
+             * symbolized frames per sample, outermost first, with the number of
+             * bytes the sample stands for.
+             * 
+             * The samples are copied before they are written, so allocations
+             * are not held up while the dump symbolizes and formats them.
+             * 
+             * @param file   The file to write to.
+             * @param format The output format.
+             * @return error `null_pointer` if file is null.
+             */
+            static error dump(FILE *file, heap_profile_format format);
+
+            /**
+             * @brief
+             * Write the live samples to the file at path, replacing it.
+             */
+            static error dump(const char *path, heap_profile_format format);
+
+            /**
+             * @brief
+             * Dump the live samples to the file at path whenever the process
+             * receives the signal.
+             * 
+             * @param signal_number The signal, e.g. `SIGUSR2`.
+             * @param path          The file to write, up to 255 characters.
+             * @param format        The output format.
+             * @return error `invalid_argument` for a path too long, or
+             *         `invalid_operation` if the handler cannot be installed.
+             */
+            static error dump_on_signal(int signal_number, const char *path, heap_profile_format format);
+
+            /**
+             * @brief
+             * Write the dump requested by a signal, if any.
+             */
+            static void poll();
+
+        private:
+            static heap_sample *record(size_t size);
+        };
+
+        /**
+         * @brief
+         * Reports the allocations of the parent to the `heap_profiler`.
+         * 
+         * @details
+         * Each block carries the sample it belongs to in a prefix, so a free is
+         * only looked up in the profiler when the block was sampled. Wrapping
+         * the global allocator profiles every `make_object()`:
+         * ```C++
+         *      namespace ltd::memory {
+         *          class global_allocator : public sampling_allocator<heap_allocator> {};
+         *      }
+         * ```
+         * 
+         * Blocks released with `deallocate_all()` keep their samples.
+         * 
+         * @tparam Parent The allocator to get blocks from.
+         */
+        template<typename Parent>
+        class sampling_allocator
+        {
+            struct sample_prefix
+            {
+                heap_sample *sample;
+            };
+
+            affix_allocator<Parent, sample_prefix> allocator;
+
+        public:
+            using parent_type = Parent;
+
+            static constexpr bool thread_safe = is_thread_safe_allocator<Parent>;
+
+            ret<block,error> allocate(size_t allocation_size)
+            {
+                auto [blk, err] = allocator.allocate(allocation_size);
+                if (err == error::no_error)
+                    allocator.prefix(blk)->sample = heap_profiler::sample(blk.size);
+
+                return {blk, err};
+            }
+
+            ret<block,error> allocate(size_t allocation_size, size_t alignment)
+            {
+                auto [blk, err] = allocator.allocate(allocation_size, alignment);
+                if (err == error::no_error)
+                    allocator.prefix(blk)->sample = heap_profiler::sample(blk.size);
+
+                return {blk, err};
+            }
+
+            ret<block,error> allocate_all()
+            {
+                return allocator.allocate_all();
+            }
+
+            error deallocate(block allocated_block)
+            {
+                if (allocated_block.ptr == nullptr)
+                    return error::null_pointer;
+
+                heap_sample *sample = allocator.prefix(allocated_block)->sample;
+                if (sample != nullptr)
+                    heap_profiler::forget(sample);
+
+                return allocator.deallocate(allocated_block);
+            }
+
+            error deallocate_all()
+            {
+                return allocator.deallocate_all();
+            }
+
+            error expand(block& allocated_block, size_t delta)
+            {
+                auto err = allocator.expand(allocated_block, delta);
+                if (err != error::no_error)
+                    return err;
+
+                heap_sample *sample = allocator.prefix(allocated_block)->sample;
+                if (sample != nullptr)
+                    heap_profiler::resize(sample, allocated_block.size);
+
+                return error::no_error;
+            }
+
+            ret<bool,error> owns(block mem_block)
+            {
+                return allocator.owns(mem_block);
+            }
+        };
+
+        /**
+         * Operations recorded in an allocation trace.
+         */
+        enum class trace_operation : uint8_t
+        {
+            Allocate,
+            Deallocate,
+            DeallocateAll,
+            Expand
+        };
+
+        /**
+         * @brief
+         * One operation of an allocation trace, as stored in the trace file.
+         * 
+         * @details
+         * The address identifies the block within the trace. An expansion may
+         * move the block, its origin is the address before the expansion. The
+         * size is the requested size for an allocation, the size of the block
+         * for a deallocation and the new size for an expansion.
+         */
+        struct trace_record
+        {
+            uint64_t timestamp;
+            uint64_t address;
+            uint64_t origin;
+            uint64_t size;
+            uint32_t thread;
+            uint8_t  operation;
+            uint8_t  alignment_log2;
+            uint16_t reserved;
+        };
+
+        static_assert(sizeof(trace_record) == 40, "trace_record must stay 40 bytes");
+
+        /**
+         * @brief
+         * A binary allocation trace file written by `recording_allocator`.
+         * 
+         * @details
+         * The file starts with a small header followed by fixed size
+         * `trace_record`s in the order the operations were made. Timestamps are
+         * nanoseconds since the trace was opened, threads are numbered in the
+         * order they first record. Records are buffered and written under a
+         * lock, so one trace can be shared by many threads and allocators.
+         * 
+         * `load()` reads a trace back for `replay()`.
+         */
+        class allocation_trace
+        {
+            FILE                      *file;
+            std::mutex                 lock;
+            std::vector<trace_record>  buffer;
+            uint64_t                   start;
+
+            static inline std::atomic<allocation_trace*> global_trace{nullptr};
+
+        public:
+            /**
+             * @brief
+             * Create the trace file at path, replacing it. Check `is_open()` to
+             * find out whether it succeeded.
+             */
+            allocation_trace(const char *path);
+
+            allocation_trace(const allocation_trace& other) = delete;
+            allocation_trace& operator=(const allocation_trace& other) = delete;
+
+            /**
+             * @brief
+             * Write the buffered records and close the file.
+             */
+            ~allocation_trace();
+
+            bool is_open() const;
+
+            /**
+             * @brief
+             * Append an operation to the trace.
+             */
+            void record(trace_operation operation, const void *address, size_t size, size_t alignment,
+                        const void *origin = nullptr);
+
+            /**
+             * @brief
+             * Write the buffered records to the file.
+             */
+            error flush();
+
+            /**
+             * @brief
+             * Read a whole trace file.
+             * 
+             * @return ret<std::vector<trace_record>,error> The records, or
+             *         `invalid_argument` if the file is not a trace.
+             */
+            static ret<std::vector<trace_record>,error> load(const char *path);
+
+            /**
+             * @brief
+             * Get the trace that default-constructed recording allocators write
+             * to, nullptr if there is none.
+             */
+            static allocation_trace *global();
+
+            /**
+             * @brief
+             * Set the trace that default-constructed recording allocators write
+             * to. It must outlive them.
+             */
+            static void set_global(allocation_trace *trace);
+        };
+
+        /**
+         * @brief
+         * Records every allocation, deallocation and expansion made through the
+         * parent in an `allocation_trace`.
+         * 
+         * @details
+         * The trace of a real workload can then be replayed on other allocator
+         * compositions with `replay()` or the `ltd-replay` tool:
+         * ```C++
+         *      memory::allocation_trace trace("/tmp/sessions.trace");
+         *      memory::allocation_trace::set_global(&trace);
+         * 
+         *      namespace ltd::memory {
+         *          class global_allocator : public recording_allocator<heap_allocator> {};
+         *      }
+         * ```
+         * 
+         * Without a trace the allocator only forwards to the parent.
+         * 
+         * @tparam Parent The allocator to get blocks from.
+         */
+        template<typename Parent>
+        class recording_allocator
+        {
+            Parent            parent;
+            allocation_trace *trace;
+
+        public:
+            using parent_type = Parent;
+
+            static constexpr bool thread_safe = is_thread_safe_allocator<Parent>;
+
+            recording_allocator() : trace(allocation_trace::global())
+            {}
+
+            recording_allocator(allocation_trace& destination) : trace(&destination)
+            {}
+
+            ret<block,error> allocate(size_t allocation_size)
+            {
+                auto [blk, err] = parent.allocate(allocation_size);
+                if (err == error::no_error && trace != nullptr)
+                    trace->record(trace_operation::Allocate, blk.ptr, allocation_size, default_alignment);
+
+                return {blk, err};
+            }
+
+            ret<block,error> allocate(size_t allocation_size, size_t alignment)
+            {
+                auto [blk, err] = allocate_aligned(parent, allocation_size, alignment);
+                if (err == error::no_error && trace != nullptr)
+                    trace->record(trace_operation::Allocate, blk.ptr, allocation_size, alignment);
+
+                return {blk, err};
+            }
+
+            ret<block,error> allocate_all()
+            {
+                auto [blk, err] = parent.allocate_all();
+                if (err == error::no_error && trace != nullptr)
+                    trace->record(trace_operation::Allocate, blk.ptr, blk.size, default_alignment);
+
+                return {blk, err};
+            }
+
+            error deallocate(block allocated_block)
+            {
+                if (allocated_block.ptr != nullptr && trace != nullptr)
+                    trace->record(trace_operation::Deallocate, allocated_block.ptr, allocated_block.size, default_alignment);
+
+                return parent.deallocate(allocated_block);
+            }
+
+            error deallocate_all()
+            {
+                if (trace != nullptr)
+                    trace->record(trace_operation::DeallocateAll, nullptr, 0, default_alignment);
+
+                return parent.deallocate_all();
+            }
+
+            error expand(block& allocated_block, size_t delta)
+            {
+                void *origin = allocated_block.ptr;
+
+                auto err = parent.expand(allocated_block, delta);
+                if (err == error::no_error && trace != nullptr)
+                    trace->record(trace_operation::Expand, allocated_block.ptr, allocated_block.size, default_alignment, origin);
+
+                return err;
+            }
+
+            ret<bool,error> owns(block mem_block)
+            {
+                return parent.owns(mem_block);
+            }
+        };
+
+        /**
+         * The outcome of replaying a trace on an allocator.
+         */
+        struct replay_result
+        {
+            size_t   operations;
+            size_t   failures;
+            uint64_t nanoseconds;
+            size_t   peak_bytes;
+        };
+
+        /**
+         * @brief
+         * Replay an allocation trace on an allocator and time it.
+         * 
+         * @details
+         * The operations are replayed on the calling thread in the order they
+         * were recorded. The blocks are resolved before the clock starts, so
+         * only the allocator calls are timed. Operations on blocks allocated
+         * before the trace started are skipped. Blocks still live at the end of
+         * the trace are freed after the clock stops.
+         * ```C++
+         *      auto [trace, err] = memory::allocation_trace::load("/tmp/sessions.trace");
+         *      memory::bucketizer<pool, 0, 256, 16> candidate;
+         *      auto result = memory::replay(trace, candidate);
+         * ```
+         * 
+         * @param trace     The records of the trace.
+         * @param allocator The allocator to drive.
+         * @return replay_result The number of replayed operations, the failed
+         *         ones, the time spent and the peak of live bytes.
+         */
+        template<typename A>
+        replay_result replay(const std::vector<trace_record>& trace, A& allocator)
+        {
+            struct step
+            {
+                trace_operation operation;
+                uint32_t        slot;
+                uint64_t        size;
+                size_t          alignment;
+            };
+
+            std::vector<step> steps;
+            std::unordered_map<uint64_t, uint32_t> live;
+            uint32_t slot_count = 0;
+
+            steps.reserve(trace.size());
+
+            for (const trace_record& record : trace) {
+                trace_operation operation = (trace_operation)record.operation;
+                size_t alignment = (size_t)1 << record.alignment_log2;
+
+                if (operation == trace_operation::Allocate) {
+                    live[record.address] = slot_count;
+                    steps.push_back({operation, slot_count++, record.size, alignment});
+                } else if (operation == trace_operation::DeallocateAll) {
+                    live.clear();
+                    steps.push_back({operation, 0, 0, alignment});
+                } else if (operation == trace_operation::Expand) {
+                    auto found = live.find(record.origin);
+                    if (found == live.end())
+                        continue;
+
+                    uint32_t slot = found->second;
+                    steps.push_back({operation, slot, record.size, alignment});
+
+                    live.erase(found);
+                    live[record.address] = slot;
+                } else {
+                    auto found = live.find(record.address);
+                    if (found == live.end())
+                        continue;
+
+                    steps.push_back({operation, found->second, record.size, alignment});
+                    live.erase(found);
+                }
+            }
+
+            std::vector<block> blocks(slot_count, block{nullptr, 0});
+            replay_result result{0, 0, 0, 0};
+            size_t live_bytes = 0;
+
+            auto started = std::chrono::steady_clock::now();
+
+            for (const step& s : steps) {
+                error err = error::no_error;
+                block& blk = blocks[s.slot];
+
+                switch (s.operation) {
+                case trace_operation::Allocate:
+                    std::tie(blk, err) = allocate_aligned(allocator, s.size, s.alignment);
+                    if (err == error::no_error)
+                        live_bytes += blk.size;
+                    break;
+
+                case trace_operation::Deallocate:
+                    if (blk.ptr == nullptr)
+                        continue;
+
+                    live_bytes -= blk.size;
+                    err = allocator.deallocate(blk);
+                    blk = {nullptr, 0};
+                    break;
+
+                case trace_operation::DeallocateAll:
+                    err = allocator.deallocate_all();
+                    for (block& b : blocks)
+                        b = {nullptr, 0};
+                    live_bytes = 0;
+                    break;
+
+                case trace_operation::Expand:
+                    if (blk.ptr == nullptr || s.size <= blk.size)
+                        continue;
+
+                    {
+                        size_t old_size = blk.size;
+                        err = allocator.expand(blk, s.size - old_size);
+                        if (err == error::no_error)
+                            live_bytes += blk.size - old_size;
+                    }
+                    break;
+                }
+
+                result.operations++;
+
+                if (err != error::no_error)
+                    result.failures++;
+
+                if (live_bytes > result.peak_bytes)
+                    result.peak_bytes = live_bytes;
+            }
+
+            auto elapsed = std::chrono::steady_clock::now() - started;
+            result.nanoseconds = std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count();
+
+            for (block& blk : blocks)
+                if (blk.ptr != nullptr)
+                    allocator.deallocate(blk);
+
+            return result;
+        }
+
+        /**
+         * @brief
+         * Object cache that keeps freed objects of type T constructed and hands
+         * them out again without running the constructor.
+         * 
+         * @details
+         * This is the object caching of Bonwick's slab allocator. Slabs of
+         * `ObjectsPerSlab` slots are drawn from the parent. `acquire()` returns a
+         * cached object as it was left, and constructs a new one with the given
+         * arguments only when the cache is empty. `recycle()` gives an object back
+         * to the cache, which must be in its constructed state again by then.
+         * `release()` destroys it and frees its slot.
+         * 
+         * Objects with an expensive constructor, for instance ones that allocate
+         * internal buffers, pay for it once per slot instead of once per use:
+         * ```C++
+         *      memory::slab<session> sessions;
+         *      auto [s, err] = sessions.acquire();
+         *      ...
+         *      s->reset();
+         *      sessions.recycle(s);
+         * ```
+         * 
+         * `make_object()` draws from the cache when it is given a slab, and
+         * `default_dltr` hands the objects back through its recycle hook, which
+         * calls `T::recycle()` when T provides it:
+         * ```C++
+         *      auto obj = make_object<session>(std::allocator_arg, sessions);
+         * ```
+         * 
+         * Every slot keeps a header word before T, where `make_object()` keeps the
+         * reference counter and the cache keeps its links. The slab also serves
+         * raw slots through the allocator interface. Cached objects are destroyed
+         * by `reclaim()`, `deallocate_all()` and the destructor, the objects still
+         * in use are not.
+         * 
+         * @tparam T              The type of the cached objects.
+         * @tparam Parent         The allocator the slabs are drawn from.
+         * @tparam ObjectsPerSlab The number of slots per slab.
+         */
+        template<typename T, typename Parent = heap_allocator, size_t ObjectsPerSlab = 64>
+        class slab
+        {
+            static_assert(ObjectsPerSlab > 0, "ObjectsPerSlab must not be 0");
+
+        public:
+            using object_type = T;
+            using parent_type = Parent;
+
+            // The parent is only accessed under the lock
+            static constexpr bool thread_safe = true;
+
+            static constexpr size_t header_size    = sizeof(uint64_t);
+            static constexpr size_t object_offset  = align_up(header_size, alignof(T));
+            static constexpr size_t slot_alignment = alignof(T) > default_alignment ? alignof(T) : default_alignment;
+            static constexpr size_t slot_size      = align_up(object_offset + sizeof(T), slot_alignment);
+
+        private:
+            struct slab_header
+            {
+                slab_header *next;
+            };
+
+            static constexpr size_t slots_offset = align_up(sizeof(slab_header), slot_alignment);
+            static constexpr size_t slab_size    = slots_offset + ObjectsPerSlab * slot_size;
+
+            Parent             parent;
+            mutable std::mutex lock;
+            slab_header       *slabs;
+            char              *fresh;
+            size_t             fresh_count;
+            char              *constructed;
+            size_t             constructed_count;
+            char              *raw;
+
+        public:
+            slab() : slabs(nullptr), fresh(nullptr), fresh_count(0),
+                     constructed(nullptr), constructed_count(0), raw(nullptr)
+            {}
+
+            slab(const slab& other) = delete;
+            slab& operator=(const slab& other) = delete;
+
+            /**
+             * @brief
+             * Destroy the cached objects and give the slabs back to the parent.
+             */
+            ~slab()
+            {
+                deallocate_all();
+            }
+
+            /**
+             * @brief
+             * Get an object from the cache, or construct a new one.
+             * 
+             * @param args The constructor arguments, only used when no cached
+             *             object is available.
+             * @return ret<T*,error> The object and an error status.
+             */
+            template<typename... P>
+            ret<T*,error> acquire(P&&... args)
+            {
+                char *slot = nullptr;
+
+                {
+                    std::lock_guard<std::mutex> guard(lock);
+
+                    if (constructed != nullptr) {
+                        slot = pop(constructed);
+                        constructed_count--;
+                        return {(T*)(slot + object_offset), error::no_error};
+                    }
+
+                    slot = take_slot();
+                }
+
+                if (slot == nullptr)
+                    return {nullptr, error::allocation_failure};
+
+                T *object = (T*)(slot + object_offset);
+                construct(object, std::forward<P>(args)...);
+
+                return {object, error::no_error};
+            }
+
+            /**
+             * @brief
+             * Give a constructed object back to the cache.
+             */
+            error recycle(T *object)
+            {
+                if (object == nullptr)
+                    return error::null_pointer;
+
+                std::lock_guard<std::mutex> guard(lock);
+
+                push(constructed, (char*)object - object_offset);
+                constructed_count++;
+
+                return error::no_error;
+            }
+
+            /**
+             * @brief
+             * Destroy an object and free its slot.
+             */
+            error release(T *object)
+            {
+                if (object == nullptr)
+                    return error::null_pointer;
+
+                destruct(object);
+
+                std::lock_guard<std::mutex> guard(lock);
+                push(raw, (char*)object - object_offset);
+
+                return error::no_error;
+            }
+
+            /**
+             * @brief
+             * Destroy the cached objects and keep their slots for later use.
+             * 
+             * @return size_t The number of destroyed objects.
+             */
+            size_t reclaim()
+            {
+                std::lock_guard<std::mutex> guard(lock);
+
+                size_t count = constructed_count;
+                destroy_cached();
+
+                return count;
+            }
+
+            /**
+             * @brief
+             * Destroy the cached objects and give the slabs left without any
+             * object in use back to the parent, then shrink the parent.
+             * 
+             * @return size_t The number of bytes of slabs given back.
+             */
+            size_t shrink()
+            {
+                std::lock_guard<std::mutex> guard(lock);
+
+                destroy_cached();
+
+                // Count the free slots of every slab, looked up by address
+                std::vector<std::pair<char*,size_t>> free_slots;
+
+                for (slab_header *s = slabs; s != nullptr; s = s->next)
+                    free_slots.push_back({(char*)s, 0});
+
+                std::sort(free_slots.begin(), free_slots.end());
+
+                auto owner = [&free_slots](char *slot) {
+                    auto it = std::upper_bound(free_slots.begin(), free_slots.end(), std::make_pair(slot, SIZE_MAX));
+                    return &(it - 1)->second;
+                };
+
+                for (char *slot = raw; slot != nullptr; slot = *(char**)slot)
+                    (*owner(slot))++;
+
+                if (fresh_count > 0)
+                    *owner(fresh) += fresh_count;
+
+                auto empty = [&owner](char *ptr) { return *owner(ptr) == ObjectsPerSlab; };
+
+                for (char **link = &raw; *link != nullptr;) {
+                    if (empty(*link))
+                        *link = *(char**)*link;
+                    else
+                        link = (char**)*link;
+                }
+
+                if (fresh_count > 0 && empty(fresh)) {
+                    fresh       = nullptr;
+                    fresh_count = 0;
+                }
+
+                size_t released = 0;
+
+                for (slab_header **link = &slabs; *link != nullptr;) {
+                    slab_header *s = *link;
+
+                    if (empty((char*)s + slots_offset)) {
+                        *link = s->next;
+                        parent.deallocate({s, slab_size});
+                        released += slab_size;
+                    } else {
+                        link = &s->next;
+                    }
+                }
+
+                return released + memory::shrink(parent);
+            }
+
+            /**
+             * @brief
+             * Get the number of constructed objects in the cache.
+             */
+            size_t cached() const
+            {
+                std::lock_guard<std::mutex> guard(lock);
+                return constructed_count;
+            }
+
+            ret<block,error> allocate(size_t allocation_size)
+            {
+                return allocate(allocation_size, default_alignment);
+            }
+
+            ret<block,error> allocate(size_t allocation_size, size_t alignment)
+            {
+                if (allocation_size == 0 || is_power_of_two(alignment) == false)
+                    return {{nullptr, 0}, error::invalid_argument};
+
+                if (allocation_size > slot_size || alignment > slot_alignment)
+                    return {{nullptr, 0}, error::allocation_failure};
+
+                std::lock_guard<std::mutex> guard(lock);
+
+                char *slot = take_slot();
+                if (slot == nullptr)
+                    return {{nullptr, 0}, error::allocation_failure};
+
+                return {{slot, allocation_size}, error::no_error};
+            }
+
+            ret<block,error> allocate_all()
+            {
+                return {{nullptr, 0}, error::allocation_failure};
+            }
+
+            /**
+             * @brief
+             * Free a raw slot. Blocks larger than a slot, or that do not start a
+             * slot of this slab, are rejected with `invalid_argument`.
+             */
+            error deallocate(block allocated_block)
+            {
+                if (allocated_block.ptr == nullptr)
+                    return error::null_pointer;
+
+                if (allocated_block.size > slot_size)
+                    return error::invalid_argument;
+
+                std::lock_guard<std::mutex> guard(lock);
+
+                if (is_slot((char*)allocated_block.ptr) == false)
+                    return error::invalid_argument;
+
+                push(raw, (char*)allocated_block.ptr);
+
+                return error::no_error;
+            }
+
+            error deallocate_all()
+            {
+                std::lock_guard<std::mutex> guard(lock);
+
+                destroy_cached();
+
+                while (slabs != nullptr) {
+                    slab_header *next = slabs->next;
+                    parent.deallocate({slabs, slab_size});
+                    slabs = next;
+                }
+
+                fresh       = nullptr;
+                fresh_count = 0;
+                raw         = nullptr;
+
+                return error::no_error;
+            }
+
+            error expand(block& allocated_block, size_t delta)
+            {
+                if (allocated_block.ptr == nullptr)
+                    return error::null_pointer;
+
+                if (allocated_block.size + delta > slot_size)
+                    return error::allocation_failure;
+
+                allocated_block.size += delta;
+                return error::no_error;
+            }
+
+            ret<bool,error> owns(block mem_block)
+            {
+                std::lock_guard<std::mutex> guard(lock);
+
+                char *ptr = (char*)mem_block.ptr;
+
+                for (slab_header *s = slabs; s != nullptr; s = s->next) {
+                    char *first = (char*)s + slots_offset;
+                    if (ptr >= first && ptr < (char*)s + slab_size)
+                        return {true, error::no_error};
+                }
+
+                return {false, error::no_error};
+            }
+
+        private:
+            // The links of the free lists live in the header word of the slots
+            static void push(char *&list, char *slot)
+            {
+                *(char**)slot = list;
+                list = slot;
+            }
+
+            static char *pop(char *&list)
+            {
+                char *slot = list;
+                list = *(char**)slot;
+                return slot;
+            }
+
+            bool is_slot(char *ptr) const
+            {
+                for (slab_header *s = slabs; s != nullptr; s = s->next) {
+                    char *first = (char*)s + slots_offset;
+
+                    if (ptr >= first && ptr < (char*)s + slab_size)
+                        return (size_t)(ptr - first) % slot_size == 0;
+                }
+
+                return false;
+            }
+
+            char *take_slot()
+            {
+                if (raw != nullptr)
+                    return pop(raw);
+
+                if (fresh_count == 0) {
+                    auto [blk, err] = allocate_aligned(parent, slab_size, slot_alignment);
+                    if (err != error::no_error)
+                        return nullptr;
+
+                    slab_header *header = (slab_header*)blk.ptr;
+                    header->next = slabs;
+                    slabs = header;
+
+                    fresh       = (char*)blk.ptr + slots_offset;
+                    fresh_count = ObjectsPerSlab;
+                }
+
+                char *slot = fresh;
+                fresh += slot_size;
+                fresh_count--;
+
+                return slot;
+            }
+
+            void destroy_cached()
+            {
+                while (constructed != nullptr) {
+                    char *slot = pop(constructed);
+                    destruct((T*)(slot + object_offset));
+                    push(raw, slot);
+                }
+
+                constructed_count = 0;
+            }
+        };
+
+        /**
+         * True if A is an object cache such as `slab`, which keeps objects of
+         * `A::object_type` constructed.
+         */
+        template<typename A, typename = void>
+        constexpr bool is_object_cache = false;
+
+        template<typename A>
+        constexpr bool is_object_cache<A, decltype(std::declval<A&>().recycle(std::declval<typename A::object_type*>()), void())> = true;
+
+        /**
+         * @brief
+         * Adapts an ltd allocator to the standard Allocator requirements.
+         * 
+         * @details
+         * The adapter refers to an allocator instance, so containers can draw
+         * from a stateful allocator such as an arena. Copies and rebound copies
+         * refer to the same instance and compare equal. A default-constructed
+         * adapter refers to `shared_allocator<A>()`, one instance per process,
+         * or per thread for allocators that are not thread safe.
+         * ```C++
+         *      memory::arena_allocator arena;
+         *      std::vector<int, memory::std_allocator<int, memory::arena_allocator>> values(arena);
+         * ```
+         * 
+         * The standard containers expect allocation failures to be reported by
+         * throwing `std::bad_alloc`, which is what the adapter does.
+         * 
+         * @tparam T The value type.
+         * @tparam A The ltd allocator type.
+         */
+        template<typename T, typename A>
+        class std_allocator
+        {
+            template<typename U, typename B>
+            friend class std_allocator;
+
+            A *allocator;
+
+        public:
+            using value_type = T;
+            using allocator_type = A;
+
+            using propagate_on_container_copy_assignment = std::true_type;
+            using propagate_on_container_move_assignment = std::true_type;
+            using propagate_on_container_swap            = std::true_type;
+
+            std_allocator() noexcept : allocator(&shared_allocator<A>())
+            {}
+
+            std_allocator(A& instance) noexcept : allocator(&instance)
+            {}
+
+            template<typename U>
+            std_allocator(const std_allocator<U,A>& other) noexcept : allocator(other.allocator)
+            {}
+
+            T *allocate(size_t count)
+            {
+                size_t size = count * sizeof(T);
+                auto [blk, err] = allocate_aligned(*allocator, size > 0 ? size : 1, alignof(T));
+
+                if (err != error::no_error)
+                    throw std::bad_alloc();
+
+                return (T*)blk.ptr;
+            }
+
+            void deallocate(T *ptr, size_t count)
+            {
+                size_t size = count * sizeof(T);
+                allocator->deallocate({ptr, size > 0 ? size : 1});
+            }
+
+            A& get_allocator() const { return *allocator; }
+
+            template<typename U>
+            bool operator==(const std_allocator<U,A>& other) const { return allocator == other.allocator; }
+
+            template<typename U>
+            bool operator!=(const std_allocator<U,A>& other) const { return allocator != other.allocator; }
+        };
+
+        /**
+         * @brief
+         * Exposes an ltd allocator as a `std::pmr::memory_resource`.
+         * 
+         * @details
+         * The resource refers to an allocator instance that must outlive it.
+         * Any `std::pmr` container can then draw from ltd allocators:
+         * ```C++
+         *      memory::arena_allocator arena;
+         *      memory::resource_adapter<memory::arena_allocator> resource(arena);
+         *      std::pmr::vector<std::pmr::string> names(&resource);
+         * ```
+         * 
+         * Like `std_allocator`, allocation failures throw `std::bad_alloc` as
+         * `std::pmr::memory_resource` requires.
+         * 
+         * @tparam A The ltd allocator type.
+         */
+        template<typename A>
+        class resource_adapter : public std::pmr::memory_resource
+        {
+            A *allocator;
+
+        public:
+            resource_adapter(A& instance) : allocator(&instance)
+            {}
+
+            A& get_allocator() const { return *allocator; }
+
+        protected:
+            void *do_allocate(size_t bytes, size_t alignment) override
+            {
+                auto [blk, err] = allocate_aligned(*allocator, bytes > 0 ? bytes : 1, alignment);
+
+                if (err != error::no_error)
+                    throw std::bad_alloc();
+
+                return blk.ptr;
+            }
+
+            void do_deallocate(void *ptr, size_t bytes, size_t) override
+            {
+                // Blocks are freed by address and size whatever their alignment
+                allocator->deallocate({ptr, bytes > 0 ? bytes : 1});
+            }
+
+            bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override
+            {
+                auto adapter = dynamic_cast<const resource_adapter*>(&other);
+                return adapter != nullptr && adapter->allocator == allocator;
+            }
+        };
+
+        /**
+         * @brief
+         * Instantiate a C++ object using ltd's allocator framework.
+         * 
+         * Inside an `allocator_scope` the default allocator is replaced by the
+         * allocator of the scope. Otherwise the object is allocated from the
+         * `shared_allocator<A>()` instance rather than from a new A per call.
+         * For allocators that are not thread safe it is a per thread instance,
+         * so the object must be released on the thread that made it.
+         * 
+         * @tparam T The class to be instantiated
+         * @tparam A The allocator type. Define global_allocator to override the
+         *           default `heap_allocator`.
+         * @tparam P The variadic template for the constructor
+         * @param args
+         * @return ret<T*,error> The raw pointer to T and an error status.
+         */
+        template<typename T,
+                 typename A=typename std::conditional<is_defined<memory::global_allocator>,
+                                                                 memory::global_allocator,
+                                                                 memory::heap_allocator>::type,
+                 typename... P>
+        ret<T*,error> make(P&&... args)
+        {
+            using allocator_type = typename std::conditional<is_defined<A>, A, memory::heap_allocator>::type;
+
+            block b;
+            error e = error::no_error;
+
+            if (is_default_allocator<allocator_type> && allocator_scope::current() != nullptr) {
+                std::tie(b, e) = allocator_scope::current()->allocate(sizeof(T), alignof(T));
+            } else {
+                allocator_type& allocator = shared_allocator<allocator_type>();
+                std::tie(b, e) = allocate_aligned(allocator, sizeof(T), alignof(T));
+            }
+
+            if (e != error::no_error)
+                return {nullptr, e};
+
+            T *ptr = (T*)b.ptr;
+            construct(ptr, std::forward<P>(args)...);
+
+            return {ptr, error::no_error};
+        }
+
+        /**
+         * @brief
+         * Instantiate a C++ object using the given allocator instance.
+         * 
+         * @details
+         * Use this overload for stateful allocators, such as arenas and pools,
+         * which must not be default-constructed on every call.
+         * ```C++
+         *      memory::arena_allocator arena;
+         *      auto [ptr, err] = memory::make<session>(std::allocator_arg, arena, id);
+         * ```
+         * 
+         * @tparam T The class to be instantiated
+         * @tparam A The allocator type.
+         * @tparam P The variadic template for the constructor
+         * @param allocator The allocator to allocate from.
+         * @param args
+         * @return ret<T*,error> The raw pointer to T and an error status.
+         */
+        template<typename T, typename A, typename... P>
+        ret<T*,error> make(std::allocator_arg_t, A& allocator, P&&... args)
+        {
+            auto [b,e] = allocate_aligned(allocator, sizeof(T), alignof(T));
 
             if (e != error::no_error)
                 return {nullptr, e};
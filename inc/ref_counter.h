@@ -14,17 +14,43 @@ namespace ltd
 
     /**
      * @brief
-     * Reference counter for atomic reference counting.
+     * Counter policy of `basic_ref_counter` for objects shared across threads.
+     * The counter and the storage are atomic, this is the default.
+     */
+    struct atomic_counter_policy
+    {
+        using value_type = std::atomic_uint32_t;
+    };
+
+    /**
+     * @brief
+     * Counter policy of `basic_ref_counter` for objects that never leave the
+     * thread that created them. The counter and the storage are plain integers,
+     * so copying and destroying pointers costs no locked instruction.
+     * 
+     * ```C++
+     *      auto obj = make_object<node, default_dltr<node>, memory::heap_allocator, plain_counter_policy>();
+     * ```
+     */
+    struct plain_counter_policy
+    {
+        using value_type = uint32_t;
+    };
+
+    /**
+     * @brief
+     * Reference counter for atomic or plain reference counting.
      * 
      * Reference counters provide reference counting mechanish that can be used
      * for automatic object deconstruction and memory deallocation.
      * 
-     * This reference counter provides atomic counter, which means it is thread
-     * safe and lock free. It also provides a 32 bit value space that can be
-     * used as flags or other small capacity storage.
+     * With `atomic_counter_policy` the counter is atomic, which means it is
+     * thread safe and lock free. With `plain_counter_policy` it is a plain
+     * integer that only one thread may use. It also provides a 32 bit value
+     * space that can be used as flags or other small capacity storage.
      * 
-     * The reference counter's total size is 64 bit, with 32 bit atomic counter
-     * and 32 bit storage.
+     * The reference counter's total size is 64 bit, with 32 bit counter and
+     * 32 bit storage, whatever the policy.
      * 
      * This template class provides reference counting mechanism for ltd's 
      * ```object``` and ```pointer``` framework. The reference counter supports
@@ -57,11 +83,13 @@ namespace ltd
      * that the pointer is no longer valid even though it is not entirely freed and
      * given back to the allocator.
      *
+     * @tparam C The counter policy.
      */
-    class ref_counter
+    template<typename C = atomic_counter_policy>
+    class basic_ref_counter
     {
-        std::atomic_uint32_t counter;
-        std::atomic_uint32_t storage;
+        typename C::value_type counter;
+        typename C::value_type storage;
 
     public:
         /**
@@ -72,18 +100,22 @@ namespace ltd
          * 
          * @param data The state to store in the `ref_counter`.
          */
-        ref_counter(uint32_t data);
+        basic_ref_counter(uint32_t data) : counter(1), storage(data)
+        {}
 
-        ref_counter() = delete;
-        ref_counter(ref_counter& other) = delete;
-        ref_counter(const ref_counter& other) = delete;
-        ref_counter& operator=(ref_counter other) = delete;
+        basic_ref_counter() = delete;
+        basic_ref_counter(basic_ref_counter& other) = delete;
+        basic_ref_counter(const basic_ref_counter& other) = delete;
+        basic_ref_counter& operator=(basic_ref_counter other) = delete;
 
         /**
          * @brief
          * Increment the reference.
          */
-        void inc();
+        void inc()
+        {
+            ++counter;
+        }
 
         /**
          * @brief
@@ -92,7 +124,10 @@ namespace ltd
          * @return true If the counter reached 0.
          * @return false If the counter is more than 0.
          */
-        bool dec();
+        bool dec()
+        {
+            return --counter == 0;
+        }
 
         /**
          * @brief
@@ -100,7 +135,10 @@ namespace ltd
          * 
          * @return uint32_t The value of data stored in the reference counter.
          */
-        inline uint32_t get_data() const;
+        inline uint32_t get_data() const
+        {
+            return storage;
+        }
 
         /**
          * @brief
@@ -108,7 +146,10 @@ namespace ltd
          * 
          * @param data The data to store.
          */
-        inline void set_data(uint32_t data);
+        inline void set_data(uint32_t data)
+        {
+            storage = data;
+        }
 
         /**
          * @brief
@@ -118,7 +159,15 @@ namespace ltd
          * @return ret<bool,error> True if it is 1, false if it is 0. error::index_out_of_bound 
          *         if the specified bit is beyond the 31.
          */
-        ret<bool,error> test_data_bit(uint8_t bit_position) const;
+        ret<bool,error> test_data_bit(uint8_t bit_position) const
+        {
+            if (bit_position > 31)
+                return {false, error::index_out_of_bound};
+
+            bool result = (storage & 1 << bit_position) > 0;
+
+            return { result, error::no_error};
+        }
 
         /**
          * @brief
@@ -127,7 +176,15 @@ namespace ltd
          * @param bit_position The bit position to set.
          * @return error error::index_out_of_bound if the specified bit is beyond the 31.
          */
-        error set_data_bit(uint8_t bit_position);
+        error set_data_bit(uint8_t bit_position)
+        {
+            if (bit_position > 31)
+                return error::index_out_of_bound;
+
+            storage |= 1 << bit_position;
+
+            return error::no_error;
+        }
 
         /**
          * @brief
@@ -136,8 +193,26 @@ namespace ltd
          * @param bit_position The bit position to unset.
          * @return error error::index_out_of_bound if the specified bit is beyond the 31.
          */
-        error unset_data_bit(uint8_t bit_position);
+        error unset_data_bit(uint8_t bit_position)
+        {
+            if (bit_position > 31)
+                return error::index_out_of_bound;
+
+            storage &= ~(1 << bit_position);
+
+            return error::no_error;
+        }
     };
+
+    /**
+     * The thread safe reference counter used by default.
+     */
+    using ref_counter = basic_ref_counter<atomic_counter_policy>;
+
+    // Blocks made by `make_object()` and the slots of object caches leave the
+    // same room for the counter whatever its policy.
+    static_assert(sizeof(basic_ref_counter<plain_counter_policy>) == sizeof(ref_counter),
+                  "Every counter policy must keep the size of the reference counter");
 }
 
 #endif //_LTD_INCLUDE_REF_COUNTERS_H_
@@ -10,9 +10,42 @@
 
 namespace ltd
 {
-    bool is_block_smart_ptr(const ref_counter *rc);
-    bool is_valid_smart_ptr(const ref_counter *rc);
-    void invalidate_smart_ptr(ref_counter *rc);
+    template<typename C>
+    bool is_block_smart_ptr(const basic_ref_counter<C> *rc)
+    {
+        auto [res, err] = rc->test_data_bit(0);
+        return res;
+    }
+
+    template<typename C>
+    bool is_valid_smart_ptr(const basic_ref_counter<C> *rc)
+    {
+        auto [res, err] = rc->test_data_bit(1);
+        return res;
+    }
+
+    template<typename C>
+    bool is_scoped_smart_ptr(const basic_ref_counter<C> *rc)
+    {
+        auto [res, err] = rc->test_data_bit(2);
+        return res;
+    }
+
+    template<typename C>
+    void invalidate_smart_ptr(basic_ref_counter<C> *rc)
+    {
+        rc->unset_data_bit(1);
+    }
+
+    /**
+     * True if T provides `recycle()`, which brings a used object back to its
+     * constructed state.
+     */
+    template<typename T, typename = void>
+    constexpr bool is_recyclable = false;
+
+    template<typename T>
+    constexpr bool is_recyclable<T, decltype(std::declval<T&>().recycle(), void())> = true;
 
     /**
      * @brief
@@ -43,31 +76,114 @@ namespace ltd
             else
                 delete ptr;
         }
+
+        /**
+         * @brief
+         * The recycle hook, called instead of the destructor when the object
+         * goes back to an object cache such as `memory::slab`. It calls
+         * `T::recycle()` when T provides it, so the object can return to its
+         * constructed state.
+         */
+        void recycle(T *ptr)
+        {
+            if constexpr (is_recyclable<T>)
+                ptr->recycle();
+        }
     };
 
-    template <typename T, typename D, typename A>
-    void destroy_smart_ptr(T *ptr, ref_counter *rc)
+    /**
+     * True if the deleter D provides a recycle hook for T.
+     */
+    template<typename D, typename T, typename = void>
+    constexpr bool has_recycle_hook = false;
+
+    template<typename D, typename T>
+    constexpr bool has_recycle_hook<D, T, decltype(std::declval<D&>().recycle(std::declval<T*>()), void())> = true;
+
+    /**
+     * True if objects of type T allocated from A go back to A constructed.
+     */
+    template<typename T, typename A, typename = void>
+    constexpr bool is_cached_by = false;
+
+    template<typename T, typename A>
+    constexpr bool is_cached_by<T, A, std::enable_if_t<memory::is_object_cache<A>>> = std::is_same<typename A::object_type, T>::value;
+
+    /**
+     * @brief
+     * The offset of T in a block allocated by `make_object()`.
+     * 
+     * The `ref_counter` sits right before T, which is placed at the first
+     * offset past the `ref_counter` that satisfies the alignment of T.
+     */
+    template<typename T>
+    constexpr size_t smart_ptr_offset()
+    {
+        return memory::align_up(sizeof(ref_counter), alignof(T));
+    }
+
+    /**
+     * @brief
+     * The offset of T in a block allocated by `make_object()` inside an
+     * `allocator_scope`.
+     * 
+     * Such blocks start with the `memory::allocator_binding` of the scope,
+     * followed by padding, the `ref_counter` and T.
+     */
+    template<typename T>
+    constexpr size_t scoped_smart_ptr_offset()
+    {
+        return memory::align_up(sizeof(memory::allocator_binding) + sizeof(ref_counter), alignof(T));
+    }
+
+    template <typename T, typename D, typename A, typename C>
+    void destroy_smart_ptr(T *ptr, basic_ref_counter<C> *rc, A& allocator)
     {
         D deleter;
         bool block_allocation = is_block_smart_ptr(rc);
 
+        // Objects of an object cache go back to it constructed, through the
+        // recycle hook of the deleter.
+        if constexpr (is_cached_by<T,A> && has_recycle_hook<D,T>) {
+            if (block_allocation) {
+                deleter.recycle(ptr);
+                memory::destruct(rc);
+                allocator.recycle(ptr);
+                return;
+            }
+        }
+
         deleter(ptr, block_allocation);
 
         // Prepare a block struct for memory deallocation
         memory::block blk;
 
         blk.ptr  = rc;
-        blk.size = sizeof(ref_counter);
+        blk.size = sizeof(*rc);
 
         // If the ref_counter and T was created using block allocation
-        // then we set the block size to accomodate both the size of
-        // the `ref_counter` and the size of T.
-        if (block_allocation)
-            blk.size += sizeof(T);
+        // then the block starts at the beginning of the padding before
+        // the `ref_counter` and spans until the end of T.
+        if (block_allocation) {
+            blk.ptr  = (char*)ptr - smart_ptr_offset<T>();
+            blk.size = smart_ptr_offset<T>() + sizeof(T);
+        }
+
+        // Blocks allocated inside an allocator_scope go back to the allocator
+        // of the scope, which is recorded at the beginning of the block.
+        if (block_allocation && is_scoped_smart_ptr(rc)) {
+            blk.ptr  = (char*)ptr - scoped_smart_ptr_offset<T>();
+            blk.size = scoped_smart_ptr_offset<T>() + sizeof(T);
+
+            memory::destruct(rc);
+
+            memory::allocator_binding binding = *(memory::allocator_binding*)blk.ptr;
+            binding.deallocate(blk);
+            return;
+        }
 
         memory::destruct(rc);
 
-        A allocator;
         allocator.deallocate(blk);
     }
 
@@ -92,26 +208,36 @@ namespace ltd
      * C++ object, the reference counter object and also deallocate the memory
      * for the object along with the memory allocated for the reference counter.
      * 
+     * The pointer refers to the allocator instance of its object, so the last
+     * reference releases the memory to the right instance. The reference takes
+     * no space for stateless allocators.
+     * 
+     * The counter policy decides whether the reference count is atomic. With
+     * `plain_counter_policy`, copies of the pointer must stay on one thread.
+     * 
      * @tparam T The type of the element pointer.
      * @tparam D The type of the deleter.
      * @tparam A The type of the allocator.
+     * @tparam C The counter policy.
      */
     template<typename T,
              typename D=default_dltr<T>,
              typename A=typename std::conditional<is_defined<memory::global_allocator>,
                                                               memory::global_allocator,
-                                                              memory::heap_allocator>::type
+                                                              memory::heap_allocator>::type,
+             typename C=atomic_counter_policy
             >
-    class pointer
+    class pointer : private memory::allocator_ref<A>
     {
-    private:
-        T *raw_ptr;
-        ref_counter *refcount;
-
     public: // types
         using element_type   = T;
         using deleter_type   = D;
         using allocator_type = A;
+        using counter_type   = basic_ref_counter<C>;
+
+    private:
+        T *raw_ptr;
+        counter_type *refcount;
 
     public: // ctors
 
@@ -128,8 +254,10 @@ namespace ltd
          * 
          * @param ptr        A raw pointer to `class T`.
          * @param refcounter A raw pointer to a reference counter.
+         * @param allocator  The allocator instance that owns the memory.
          */
-        pointer(T *ptr, ref_counter *refcounter)
+        pointer(T *ptr, counter_type *refcounter, memory::allocator_ref<A> allocator = {})
+                : memory::allocator_ref<A>(allocator), raw_ptr(nullptr), refcount(nullptr)
         {
             if (ptr != nullptr && refcounter != nullptr) {
                 refcounter->inc();
@@ -147,7 +275,7 @@ namespace ltd
          * 
          * @param other The other pointer
          */
-        pointer(pointer&& other)
+        pointer(pointer&& other) : memory::allocator_ref<A>(other)
         {
             raw_ptr = other.raw_ptr;
             refcount = other.refcount;
@@ -165,7 +293,7 @@ namespace ltd
          * 
          * @param other
          */
-        pointer(const pointer& other)
+        pointer(const pointer& other) : memory::allocator_ref<A>(other)
         {
             if (other.raw_ptr != nullptr && other.refcount != nullptr) {
                 other.refcount->inc();
@@ -190,15 +318,23 @@ namespace ltd
          */
         pointer& operator=(const pointer& other)
         {
-            if (other.is_valid()) {
+            if (this == &other)
+                return *this;
+
+            // Take the new reference before releasing the old one
+            if (other.raw_ptr != nullptr && other.refcount != nullptr)
                 other.refcount->inc();
 
+            clear();
+
+            memory::allocator_ref<A>::operator=(other);
+
+            if (other.raw_ptr != nullptr && other.refcount != nullptr) {
                 raw_ptr = other.raw_ptr;
                 refcount = other.refcount;
-            } else {
-                raw_ptr = nullptr;
-                refcount = nullptr;
             }
+
+            return *this;
         }
 
         /**
@@ -207,12 +343,11 @@ namespace ltd
          */
         void clear()
         {
-            if (raw_ptr != nullptr)
-                raw_ptr = nullptr;
+            if (refcount != nullptr && refcount->dec())
+                destroy_smart_ptr<T,D,A>(raw_ptr, refcount, this->get());
 
-            if (refcount != nullptr)
-                if (refcount->dec())
-                    destroy_smart_ptr<T,D,A>(raw_ptr, refcount);
+            raw_ptr = nullptr;
+            refcount = nullptr;
         }
 
         /**
@@ -279,27 +414,37 @@ namespace ltd
      * `pointer::is_valid()' will return `false`. This is to prevent access to
      * invalid raw pointer.
      *  
+     * Objects created with an allocator instance keep a reference to it and
+     * hand it to their pointers, see `make_object(std::allocator_arg, ...)`.
+     * The reference takes no space for stateless allocators.
+     * 
+     * Objects that never leave their thread can use `plain_counter_policy`,
+     * which makes copying and destroying their pointers cheaper.
+     * 
      * @tparam T
      * @tparam D
      * @tparam A
+     * @tparam C The counter policy.
      */
     template <typename T,
               typename D=default_dltr<T>,
               typename A=typename std::conditional<is_defined<memory::global_allocator>,
                                                               memory::global_allocator,
-                                                              memory::heap_allocator>::type
+                                                              memory::heap_allocator>::type,
+              typename C=atomic_counter_policy
             >
-    class object
+    class object : private memory::allocator_ref<A>
     {
     public: // types
         using element_type   = T;
         using deleter_type   = D;
         using allocator_type = A;
-        using pointer_type   = pointer<T,D,A>;
+        using counter_type   = basic_ref_counter<C>;
+        using pointer_type   = pointer<T,D,A,C>;
 
     private:
         element_type *raw_ptr;
-        ref_counter  *refcount;
+        counter_type *refcount;
 
     public: // ctors
 
@@ -334,7 +479,22 @@ namespace ltd
          * @param ptr
          * @param rc
          */
-        object(T *ptr, ref_counter *rc) : raw_ptr(ptr), refcount(rc)
+        object(T *ptr, counter_type *rc) : raw_ptr(ptr), refcount(rc)
+        {
+            assert(ptr == (T*)(rc+1));
+        }
+
+        /**
+         * @brief
+         * Construct a new object from a block allocated by the given allocator
+         * instance. This constructor is used by the `make_object<>()` function.
+         * 
+         * @param ptr
+         * @param rc
+         * @param allocator
+         */
+        object(T *ptr, counter_type *rc, A& allocator)
+                : memory::allocator_ref<A>(allocator), raw_ptr(ptr), refcount(rc)
         {
             assert(ptr == (T*)(rc+1));
         }
@@ -348,7 +508,7 @@ namespace ltd
          * 
          * @param other The other object
          */
-        object(object&& other)
+        object(object&& other) : memory::allocator_ref<A>(other)
         {
             raw_ptr = other.raw_ptr;
             other.raw_ptr = nullptr;
@@ -390,21 +550,21 @@ namespace ltd
          * @brief
          * Get the pointer object
          * 
-         * @return ret<pointer<T,D,A>, error>
+         * @return ret<pointer_type, error>
          */
-        ret<pointer<T,D,A>, error> get_pointer()
+        ret<pointer_type, error> get_pointer()
         {
             if (refcount == nullptr) {
                 auto err = make_ref_counter();
 
                 if (err != error::no_error) {
                     // If we failed creating reference counter, return null pointer
-                    pointer<T,D,A> ptr;
+                    pointer_type ptr;
                     return {ptr, err};
                 }
             }
 
-            pointer<T,D,A> ptr = pointer<T,D,A>(raw_ptr, refcount);
+            pointer_type ptr = pointer_type(raw_ptr, refcount, *this);
 
             return {ptr, error::no_error};
         }
@@ -436,7 +596,7 @@ namespace ltd
                     // If the reference is zero, then destroy the pointer and the refcounter
                     // Otherwise, tell everyone that this pointer is nolonger valid
                     if (refcount->dec())
-                        destroy_smart_ptr<T,D,A>(raw_ptr, refcount);
+                        destroy_smart_ptr<T,D,A>(raw_ptr, refcount, this->get());
                     else
                         invalidate_smart_ptr(refcount);
 
@@ -466,8 +626,7 @@ namespace ltd
             if (refcount != nullptr)
                 return error::invalid_operation;
 
-            allocator_type allocator;
-            auto [blk, err] = allocator.allocate(sizeof(ref_counter));
+            auto [blk, err] = this->get().allocate(sizeof(counter_type));
 
             if (err != error::no_error)
                 return err;
@@ -475,35 +634,147 @@ namespace ltd
             if (blk.ptr == nullptr || blk.size == 0)
                 return error::allocation_failure;
 
-            refcount = (ref_counter*) blk.ptr;
-            memory::construct(refcount, 1);
+            // Wrapped pointer mode: valid, but not block allocated
+            refcount = (counter_type*) blk.ptr;
+            memory::construct(refcount, 2);
 
             return error::no_error;
         }
     };
 
+    /**
+     * Smart pointers only hold the addresses of their element and counter, so
+     * buffers of them grow with `memcpy()` rather than by copying references.
+     */
+    template<typename T, typename D, typename A, typename C>
+    constexpr bool is_trivially_relocatable<pointer<T,D,A,C>> = true;
+
+    template<typename T, typename D, typename A, typename C>
+    constexpr bool is_trivially_relocatable<object<T,D,A,C>> = true;
+
+    /**
+     * @brief
+     * Create an object from the default instance of A.
+     * 
+     * Inside an `allocator_scope` the default allocator is replaced by the
+     * allocator of the scope. Otherwise the memory comes from the
+     * `memory::shared_allocator<A>()` instance rather than from a new A per
+     * call. For allocators that are not thread safe, see
+     * `memory::is_thread_safe_allocator`, that instance belongs to the calling
+     * thread, so the object must be released on that thread before it exits.
+     */
     template<typename T,
              typename D=default_dltr<T>,
              typename A=typename std::conditional<is_defined<memory::global_allocator>,
                                                              memory::global_allocator,
                                                              memory::heap_allocator>::type,
+             typename C=atomic_counter_policy,
+             typename... P>
+    object<T,D,A,C> make_object(P&&... args)
+    {
+        using counter_type = basic_ref_counter<C>;
+
+        if constexpr (is_cached_by<T,A>)
+            return make_object<T,D,A,C>(std::allocator_arg, memory::shared_allocator<A>(), std::forward<P>(args)...);
+
+        // Inside an allocator_scope, the allocator of the scope replaces the
+        // default allocator.
+        if (memory::is_default_allocator<A> && memory::allocator_scope::current() != nullptr) {
+            const memory::allocator_binding *scope = memory::allocator_scope::current();
+            constexpr size_t alignment = alignof(T) > alignof(memory::allocator_binding) ? alignof(T)
+                                                                                          : alignof(memory::allocator_binding);
+
+            auto [mem_block, err] = scope->allocate(scoped_smart_ptr_offset<T>() + sizeof(T), alignment);
+
+            if (err != error::no_error)
+                return object<T,D,A,C>(nullptr);
+
+            T *instance     = (T*)((char*)mem_block.ptr + scoped_smart_ptr_offset<T>());
+            counter_type *rc = (counter_type*)instance - 1;
+
+            memory::construct((memory::allocator_binding*)mem_block.ptr, *scope);
+            memory::construct(instance, std::forward<P>(args)...);
+            memory::construct(rc, 7);
+
+            object<T,D,A,C> obj(instance, rc);
+            return obj;
+        }
+
+        A& allocator = memory::shared_allocator<A>();
+
+        // Allocate the ref_counter and T at once, with T at an offset that
+        // satisfies its alignment and the ref_counter right before it.
+        constexpr size_t alignment = alignof(T) > alignof(counter_type) ? alignof(T) : alignof(counter_type);
+
+        auto [mem_block, err] = memory::allocate_aligned(allocator, smart_ptr_offset<T>() + sizeof(T), alignment);
+
+        if (err != error::no_error)
+            return object<T,D,A,C>(nullptr);
+
+        T *instance     = (T*)((char*)mem_block.ptr + smart_ptr_offset<T>());
+        counter_type *rc = (counter_type*)instance - 1;
+
+        memory::construct(instance, std::forward<P>(args)...);
+        memory::construct(rc, 3);
+
+        object<T,D,A,C> obj(instance, rc);
+        return obj;
+    }
+
+    /**
+     * @brief
+     * Create an object from the given allocator instance.
+     * 
+     * The object and its pointers release the memory to that same instance,
+     * which must outlive them. Use it for stateful allocators such as arenas
+     * and pools:
+     * ```C++
+     *      memory::arena_allocator arena;
+     *      auto obj = make_object<session>(std::allocator_arg, arena, id);
+     * ```
+     * 
+     * Given a `memory::slab<T>`, the object comes from its cache and goes
+     * back to it constructed when the last reference is gone.
+     */
+    template<typename T,
+             typename D=default_dltr<T>,
+             typename A,
+             typename C=atomic_counter_policy,
              typename... P>
-    object<T,D,A> make_object(P&&... args)
+    object<T,D,A,C> make_object(std::allocator_arg_t, A& allocator, P&&... args)
     {
-        A allocator;
+        using counter_type = basic_ref_counter<C>;
+
+        // An object cache hands out constructed objects, possibly used ones
+        if constexpr (is_cached_by<T,A>) {
+            static_assert(A::object_offset == smart_ptr_offset<T>(), "The object cache does not leave room for the ref_counter");
+
+            auto [instance, err] = allocator.acquire(std::forward<P>(args)...);
+
+            if (err != error::no_error)
+                return object<T,D,A,C>(nullptr);
+
+            counter_type *rc = (counter_type*)instance - 1;
+            memory::construct(rc, 3);
+
+            object<T,D,A,C> obj(instance, rc, allocator);
+            return obj;
+        }
+
+        constexpr size_t alignment = alignof(T) > alignof(counter_type) ? alignof(T) : alignof(counter_type);
 
-        auto [mem_block, err] = allocator.allocate(sizeof(T)+sizeof(ref_counter));
+        auto [mem_block, err] = memory::allocate_aligned(allocator, smart_ptr_offset<T>() + sizeof(T), alignment);
 
         if (err != error::no_error)
-            return object<T,D,A>(nullptr);
+            return object<T,D,A,C>(nullptr);
 
-        ref_counter *rc = (ref_counter*)mem_block.ptr;
-        T *instance     = (T*)(rc+1);
+        T *instance     = (T*)((char*)mem_block.ptr + smart_ptr_offset<T>());
+        counter_type *rc = (counter_type*)instance - 1;
 
         memory::construct(instance, std::forward<P>(args)...);
         memory::construct(rc, 3);
 
-        object<T,D,A> obj(instance, rc);
+        object<T,D,A,C> obj(instance, rc, allocator);
         return obj;
     }
 }
@@ -1,5 +1,24 @@
 #include "memory.h"
 
+#include <math.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <cxxabi.h>
+#include <linux/mempolicy.h>
+#include <string>
+
+#ifdef __GLIBC__
+#include <execinfo.h>
+#include <malloc.h>
+#endif
+
 namespace ltd
 {
     namespace memory
@@ -9,6 +28,11 @@ namespace ltd
             return {{nullptr, 0}, error::allocation_failure};
         }
 
+        ret<block,error> null_allocator::allocate(size_t allocation_size, size_t alignment)
+        {
+            return {{nullptr, 0}, error::allocation_failure};
+        }
+
         ret<block,error> null_allocator::allocate_all()
         {
             return {{nullptr, 0}, error::allocation_failure};
@@ -46,6 +70,22 @@ namespace ltd
             return {blk, error::no_error};
         }
 
+        ret<block,error> heap_allocator::allocate(size_t allocation_size, size_t alignment)
+        {
+            if (is_power_of_two(alignment) == false)
+                return {{nullptr, 0}, error::invalid_argument};
+
+            if (alignment <= default_alignment)
+                return allocate(allocation_size);
+
+            // Memory from posix_memalign() is released by free() as well
+            block blk{nullptr, allocation_size};
+            if (posix_memalign(&blk.ptr, alignment, allocation_size) != 0)
+                return {{nullptr, 0}, error::allocation_failure};
+
+            return {blk, error::no_error};
+        }
+
         ret<block,error> heap_allocator::allocate_all()
         {
             block blk{nullptr, 0};
@@ -69,13 +109,1984 @@ namespace ltd
 
         error heap_allocator::expand(block& allocated_block, size_t delta)
         {
-            // TODO: implement this
-            return error::allocation_failure;
+            return expand(allocated_block, delta, default_alignment);
+        }
+
+        error heap_allocator::expand(block& allocated_block, size_t delta, size_t alignment)
+        {
+            if (allocated_block.ptr == nullptr)
+                return error::null_pointer;
+
+            if (is_power_of_two(alignment) == false)
+                return error::invalid_argument;
+
+            if (delta > SIZE_MAX - allocated_block.size)
+                return error::allocation_failure;
+
+            size_t size = allocated_block.size + delta;
+
+#ifdef __GLIBC__
+            // The chunk may already be large enough
+            if (malloc_usable_size(allocated_block.ptr) >= size) {
+                allocated_block.size = size;
+                return error::no_error;
+            }
+#endif
+
+            void *ptr = nullptr;
+
+            if (alignment <= default_alignment) {
+                // realloc() grows in place when it can. For chunks that malloc
+                // mapped directly, glibc moves them with mremap() instead of copying.
+                ptr = realloc(allocated_block.ptr, size);
+
+                if (ptr == nullptr)
+                    return error::allocation_failure;
+            } else {
+                // realloc() does not keep a larger alignment, so the block moves
+                // to a new aligned chunk and the old one is freed last.
+                if (posix_memalign(&ptr, alignment, size) != 0)
+                    return error::allocation_failure;
+
+                memcpy(ptr, allocated_block.ptr, allocated_block.size);
+                free(allocated_block.ptr);
+            }
+
+            allocated_block.ptr  = ptr;
+            allocated_block.size = size;
+
+            return error::no_error;
         }
 
         ret<bool,error> heap_allocator::owns(block mem_block)
         {
-            return {false, error::invalid_operation};
+            // The heap cannot tell its blocks apart from others. It claims every
+            // valid block so that it can serve as the last resort of a composition.
+            return {mem_block.ptr != nullptr, error::no_error};
+        }
+
+        arena_allocator::arena_allocator(size_t size) : head(nullptr), region_size(size), peak(0)
+        {}
+
+        arena_allocator::~arena_allocator()
+        {
+            while (head != nullptr) {
+                region *next = head->next;
+                free(head);
+                head = next;
+            }
+        }
+
+        char *arena_allocator::region_begin(region *r)
+        {
+            return (char*)r + align_up(sizeof(region), default_alignment);
+        }
+
+        size_t arena_allocator::padding(region *r, size_t alignment)
+        {
+            size_t top = (size_t)(region_begin(r) + r->used);
+            return align_up(top, alignment) - top;
+        }
+
+        ret<arena_allocator::region*,error> arena_allocator::reserve(size_t allocation_size)
+        {
+            size_t capacity = allocation_size > region_size ? allocation_size : region_size;
+
+            region *r = (region*)malloc(align_up(sizeof(region), default_alignment) + capacity);
+
+            if (r == nullptr)
+                return {nullptr, error::allocation_failure};
+
+            r->capacity = capacity;
+            r->used     = 0;
+
+            // Oversized regions serve a single block. Keep them behind the
+            // current region so the space left in it is not wasted.
+            if (head != nullptr && capacity > region_size) {
+                r->next    = head->next;
+                head->next = r;
+            } else {
+                r->next = head;
+                head    = r;
+            }
+
+            return {r, error::no_error};
+        }
+
+        ret<block,error> arena_allocator::allocate(size_t allocation_size)
+        {
+            return allocate(allocation_size, default_alignment);
+        }
+
+        ret<block,error> arena_allocator::allocate(size_t allocation_size, size_t alignment)
+        {
+            if (allocation_size == 0 || is_power_of_two(alignment) == false)
+                return {{nullptr, 0}, error::invalid_argument};
+
+            if (alignment < default_alignment)
+                alignment = default_alignment;
+
+            size_t rounded = align_up(allocation_size, default_alignment);
+            region *r = head;
+
+            if (r == nullptr || r->capacity - r->used < padding(r, alignment) + rounded) {
+                // Regions start at default_alignment, reserve enough to align
+                auto [reserved, err] = reserve(rounded + alignment - default_alignment);
+                if (err != error::no_error)
+                    return {{nullptr, 0}, err};
+
+                r = reserved;
+            }
+
+            r->used += padding(r, alignment);
+
+            block blk;
+            blk.ptr  = region_begin(r) + r->used;
+            blk.size = allocation_size;
+
+            r->used += rounded;
+
+            return {blk, error::no_error};
+        }
+
+        ret<block,error> arena_allocator::allocate_all()
+        {
+            if (head == nullptr || head->used == head->capacity) {
+                auto [reserved, err] = reserve(region_size);
+                if (err != error::no_error)
+                    return {{nullptr, 0}, err};
+            }
+
+            block blk;
+            blk.ptr  = region_begin(head) + head->used;
+            blk.size = head->capacity - head->used;
+
+            head->used = head->capacity;
+
+            return {blk, error::no_error};
+        }
+
+        error arena_allocator::deallocate(block allocated_block)
+        {
+            if (allocated_block.ptr == nullptr)
+                return error::null_pointer;
+
+            if (head == nullptr)
+                return error::invalid_address;
+
+            // Only the most recent block of the current region can be given
+            // back. The rest is reclaimed by deallocate_all().
+            size_t rounded = align_up(allocated_block.size, default_alignment);
+            char *top = region_begin(head) + head->used;
+
+            if ((char*)allocated_block.ptr + rounded == top && head->used >= rounded)
+                head->used -= rounded;
+
+            return error::no_error;
+        }
+
+        error arena_allocator::deallocate_all()
+        {
+            if (head == nullptr)
+                return error::no_error;
+
+            region *r = head->next;
+            while (r != nullptr) {
+                region *next = r->next;
+                free(r);
+                r = next;
+            }
+
+            if (head->used > peak)
+                peak = head->used;
+
+            head->next = nullptr;
+            head->used = 0;
+
+            // Keep the pages used during the last decay period, they are
+            // likely to be needed again by the next requests.
+            if (decay.elapsed()) {
+                purge_pages(region_begin(head) + peak, head->capacity - peak);
+                peak = 0;
+            }
+
+            return error::no_error;
+        }
+
+        error arena_allocator::expand(block& allocated_block, size_t delta)
+        {
+            if (allocated_block.ptr == nullptr)
+                return error::null_pointer;
+
+            if (head == nullptr)
+                return error::allocation_failure;
+
+            size_t rounded  = align_up(allocated_block.size, default_alignment);
+            size_t expanded = align_up(allocated_block.size + delta, default_alignment);
+            char *top = region_begin(head) + head->used;
+
+            if ((char*)allocated_block.ptr + rounded != top)
+                return error::allocation_failure;
+
+            if (head->capacity - head->used < expanded - rounded)
+                return error::allocation_failure;
+
+            head->used += expanded - rounded;
+            allocated_block.size += delta;
+
+            return error::no_error;
+        }
+
+        ret<bool,error> arena_allocator::owns(block mem_block)
+        {
+            for (region *r = head; r != nullptr; r = r->next) {
+                char *begin = region_begin(r);
+
+                if ((char*)mem_block.ptr >= begin && (char*)mem_block.ptr < begin + r->capacity)
+                    return {true, error::no_error};
+            }
+
+            return {false, error::no_error};
+        }
+
+        ret<size_t,error> arena_allocator::allocate_batch(size_t allocation_size, size_t count, block *out)
+        {
+            if (allocation_size == 0)
+                return {0, error::invalid_argument};
+
+            size_t rounded = align_up(allocation_size, default_alignment);
+
+            if (count == 0)
+                return {0, error::no_error};
+
+            if (rounded > SIZE_MAX / count)
+                return {0, error::allocation_failure};
+
+            size_t total = rounded * count;
+            region *r = head;
+
+            if (r == nullptr || r->capacity - r->used < padding(r, default_alignment) + total) {
+                auto [reserved, err] = reserve(total);
+                if (err != error::no_error)
+                    return {0, err};
+
+                r = reserved;
+            }
+
+            r->used += padding(r, default_alignment);
+            char *ptr = region_begin(r) + r->used;
+
+            for (size_t i=0; i<count; i++, ptr += rounded)
+                out[i] = {ptr, allocation_size};
+
+            r->used += total;
+
+            return {count, error::no_error};
+        }
+
+        size_t arena_allocator::purge()
+        {
+            if (head == nullptr)
+                return 0;
+
+            return purge_pages(region_begin(head) + head->used, head->capacity - head->used);
+        }
+
+        size_t page_size()
+        {
+            static const size_t size = (size_t)sysconf(_SC_PAGESIZE);
+            return size;
+        }
+
+        size_t purge_pages(void *ptr, size_t size)
+        {
+            char *begin = (char*)align_up((size_t)ptr, page_size());
+            char *end   = (char*)(((size_t)ptr + size) & ~(page_size() - 1));
+
+            if (ptr == nullptr || end <= begin)
+                return 0;
+
+#ifdef MADV_FREE
+            if (madvise(begin, end - begin, MADV_FREE) == 0)
+                return end - begin;
+#endif
+            if (madvise(begin, end - begin, MADV_DONTNEED) == 0)
+                return end - begin;
+
+            return 0;
+        }
+
+        static std::atomic<int64_t> purge_decay_ms{10000};
+
+        void set_purge_decay(std::chrono::milliseconds decay)
+        {
+            purge_decay_ms.store(decay.count(), std::memory_order_relaxed);
+        }
+
+        std::chrono::milliseconds get_purge_decay()
+        {
+            return std::chrono::milliseconds(purge_decay_ms.load(std::memory_order_relaxed));
+        }
+
+        static int64_t steady_ms()
+        {
+            auto now = std::chrono::steady_clock::now().time_since_epoch();
+            return std::chrono::duration_cast<std::chrono::milliseconds>(now).count();
+        }
+
+        decay_clock::decay_clock() : start(steady_ms())
+        {}
+
+        bool decay_clock::elapsed()
+        {
+            int64_t decay = purge_decay_ms.load(std::memory_order_relaxed);
+            if (decay <= 0)
+                return false;
+
+            int64_t now = steady_ms();
+            if (now - start < decay)
+                return false;
+
+            start = now;
+            return true;
+        }
+
+        struct purge_entry
+        {
+            void   *allocator;
+            size_t (*purge)(void*);
+        };
+
+        struct purge_registry
+        {
+            std::mutex               lock;
+            std::vector<purge_entry> entries;
+        };
+
+        static purge_registry& registry()
+        {
+            static purge_registry instance;
+            return instance;
+        }
+
+        void purge_registration::enroll(void *allocator, size_t (*purge)(void*))
+        {
+            std::lock_guard<std::mutex> guard(registry().lock);
+            registry().entries.push_back({allocator, purge});
+        }
+
+        purge_registration::~purge_registration()
+        {
+            std::lock_guard<std::mutex> guard(registry().lock);
+            auto& entries = registry().entries;
+
+            for (size_t i=0; i<entries.size(); i++) {
+                if (entries[i].allocator == instance) {
+                    entries.erase(entries.begin() + i);
+                    break;
+                }
+            }
+        }
+
+        size_t purge()
+        {
+            std::lock_guard<std::mutex> guard(registry().lock);
+            size_t total = 0;
+
+            for (auto& entry : registry().entries)
+                total += entry.purge(entry.allocator);
+
+            return total;
+        }
+
+        /**
+         * Find the cgroup v2 directory of the process, empty without cgroup v2.
+         */
+        static std::string own_cgroup()
+        {
+            FILE *file = fopen("/proc/self/cgroup", "r");
+            if (file == nullptr)
+                return {};
+
+            // The unified hierarchy is the line with the id 0 and no controller
+            char line[4096];
+            std::string path;
+
+            while (fgets(line, sizeof(line), file) != nullptr) {
+                if (strncmp(line, "0::", 3) == 0) {
+                    path = std::string("/sys/fs/cgroup") + (line + 3);
+                    path.erase(path.find_last_not_of("\n") + 1);
+                    break;
+                }
+            }
+
+            fclose(file);
+            return path;
+        }
+
+        /**
+         * Sum the counters of memory.events that tell the cgroup ran out of memory.
+         */
+        static bool read_memory_events(const std::string& path, uint64_t& total)
+        {
+            FILE *file = fopen(path.c_str(), "r");
+            if (file == nullptr)
+                return false;
+
+            char name[64];
+            unsigned long long value;
+
+            total = 0;
+            while (fscanf(file, "%63s %llu", name, &value) == 2) {
+                if (strcmp(name, "high") == 0 || strcmp(name, "max") == 0 || strcmp(name, "oom") == 0)
+                    total += value;
+            }
+
+            fclose(file);
+            return true;
+        }
+
+        /**
+         * Read the share of time some tasks stalled on memory over the last 10 seconds.
+         */
+        static double read_memory_pressure(const std::string& path)
+        {
+            FILE *file = fopen(path.c_str(), "r");
+            if (file == nullptr)
+                return 0;
+
+            double share = 0;
+            if (fscanf(file, "some avg10=%lf", &share) != 1)
+                share = 0;
+
+            fclose(file);
+            return share;
+        }
+
+        pressure_monitor::pressure_monitor(const char *cgroup)
+                : events(0), rss_budget(0), pressure_threshold(10), running(false)
+        {
+            std::string directory = cgroup != nullptr ? std::string(cgroup) : own_cgroup();
+
+            if (directory.empty() == false && access((directory + "/memory.events").c_str(), R_OK) == 0) {
+                events_path   = directory + "/memory.events";
+                pressure_path = directory + "/memory.pressure";
+
+                read_memory_events(events_path, events);
+            }
+        }
+
+        pressure_monitor::~pressure_monitor()
+        {
+            stop();
+        }
+
+        void pressure_monitor::set_rss_budget(size_t bytes)
+        {
+            rss_budget.store(bytes, std::memory_order_relaxed);
+        }
+
+        void pressure_monitor::set_pressure_threshold(double percent)
+        {
+            pressure_threshold.store(percent, std::memory_order_relaxed);
+        }
+
+        bool pressure_monitor::has_cgroup() const
+        {
+            return events_path.empty() == false;
+        }
+
+        bool pressure_monitor::under_pressure()
+        {
+            bool pressure = false;
+
+            if (has_cgroup()) {
+                std::lock_guard<std::mutex> guard(lock);
+                uint64_t total = 0;
+
+                if (read_memory_events(events_path, total) && total != events) {
+                    pressure = total > events;
+                    events   = total;
+                }
+
+                double threshold = pressure_threshold.load(std::memory_order_relaxed);
+                if (threshold > 0 && read_memory_pressure(pressure_path) >= threshold)
+                    pressure = true;
+            }
+
+            size_t budget = rss_budget.load(std::memory_order_relaxed);
+            if (budget > 0 && resident_size() > budget)
+                pressure = true;
+
+            return pressure;
+        }
+
+        size_t pressure_monitor::poll()
+        {
+            return under_pressure() ? shrink() : 0;
+        }
+
+        size_t pressure_monitor::shrink()
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            size_t total = 0;
+
+            for (auto& entry : entries)
+                total += entry.shrink(entry.allocator);
+
+            return total;
+        }
+
+        error pressure_monitor::start(std::chrono::milliseconds interval)
+        {
+            std::lock_guard<std::mutex> guard(worker_lock);
+
+            if (running)
+                return error::invalid_operation;
+
+            running = true;
+            worker  = std::thread([this, interval]() {
+                std::unique_lock<std::mutex> worker_guard(worker_lock);
+
+                while (running) {
+                    worker_signal.wait_for(worker_guard, interval, [this]() { return running == false; });
+
+                    if (running) {
+                        worker_guard.unlock();
+                        poll();
+                        worker_guard.lock();
+                    }
+                }
+            });
+
+            return error::no_error;
+        }
+
+        void pressure_monitor::stop()
+        {
+            {
+                std::lock_guard<std::mutex> guard(worker_lock);
+                running = false;
+            }
+
+            worker_signal.notify_all();
+
+            if (worker.joinable())
+                worker.join();
+        }
+
+        size_t pressure_monitor::resident_size()
+        {
+            FILE *file = fopen("/proc/self/statm", "r");
+            if (file == nullptr)
+                return 0;
+
+            unsigned long long size = 0, resident = 0;
+            if (fscanf(file, "%llu %llu", &size, &resident) != 2)
+                resident = 0;
+
+            fclose(file);
+            return resident * page_size();
+        }
+
+        void pressure_monitor::enroll(void *allocator, size_t (*shrink)(void*))
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            entries.push_back({allocator, shrink});
+        }
+
+        void pressure_monitor::withdraw(void *allocator)
+        {
+            std::lock_guard<std::mutex> guard(lock);
+
+            for (size_t i=0; i<entries.size(); i++) {
+                if (entries[i].allocator == allocator) {
+                    entries.erase(entries.begin() + i);
+                    break;
+                }
+            }
+        }
+
+        /**
+         * Ask the kernel to back the range with transparent huge pages.
+         */
+        static bool advise_huge_pages(void *ptr, size_t size)
+        {
+#ifdef MADV_HUGEPAGE
+            return madvise(ptr, size, MADV_HUGEPAGE) == 0;
+#else
+            return false;
+#endif
+        }
+
+        /**
+         * Map pre-reserved huge pages, returns MAP_FAILED when they are not available.
+         */
+        static void *map_huge_pages(size_t size, int protection, int flags)
+        {
+#ifdef MAP_HUGETLB
+            return mmap(nullptr, size, protection, flags | MAP_HUGETLB, -1, 0);
+#else
+            return MAP_FAILED;
+#endif
+        }
+
+        mmap_allocator::mmap_allocator(huge_page_mode huge_pages) : mode(huge_pages)
+        {}
+
+        size_t mmap_allocator::mapping_size(size_t size) const
+        {
+            return align_up(size, mode == huge_page_mode::Explicit ? huge_page_size : page_size());
+        }
+
+        ret<block,error> mmap_allocator::allocate(size_t allocation_size)
+        {
+            if (allocation_size == 0)
+                return {{nullptr, 0}, error::invalid_argument};
+
+            size_t length = mapping_size(allocation_size);
+            void *ptr = MAP_FAILED;
+
+            if (mode == huge_page_mode::Explicit)
+                ptr = map_huge_pages(length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS);
+
+            if (ptr == MAP_FAILED)
+                ptr = mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+            if (ptr == MAP_FAILED)
+                return {{nullptr, 0}, error::allocation_failure};
+
+            if (mode == huge_page_mode::Transparent && length >= huge_page_size)
+                advise_huge_pages(ptr, length);
+
+            return {{ptr, allocation_size}, error::no_error};
+        }
+
+        ret<block,error> mmap_allocator::allocate(size_t allocation_size, size_t alignment)
+        {
+            if (allocation_size == 0 || is_power_of_two(alignment) == false)
+                return {{nullptr, 0}, error::invalid_argument};
+
+            if (alignment <= page_size())
+                return allocate(allocation_size);
+
+            // Over-map by the alignment and unmap the slack on both sides
+            size_t length = mapping_size(allocation_size);
+            void *ptr = mmap(nullptr, length + alignment, PROT_READ | PROT_WRITE,
+                             MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+            if (ptr == MAP_FAILED)
+                return {{nullptr, 0}, error::allocation_failure};
+
+            char *begin   = (char*)ptr;
+            char *aligned = (char*)align_up((size_t)ptr, alignment);
+            char *end     = begin + length + alignment;
+
+            if (aligned > begin)
+                munmap(begin, aligned - begin);
+
+            if (end > aligned + length)
+                munmap(aligned + length, end - (aligned + length));
+
+            if (mode == huge_page_mode::Transparent && length >= huge_page_size)
+                advise_huge_pages(aligned, length);
+
+            return {{aligned, allocation_size}, error::no_error};
+        }
+
+        ret<block,error> mmap_allocator::allocate_all()
+        {
+            return {{nullptr, 0}, error::allocation_failure};
+        }
+
+        error mmap_allocator::deallocate(block allocated_block)
+        {
+            if (allocated_block.ptr == nullptr)
+                return error::null_pointer;
+
+            if (munmap(allocated_block.ptr, mapping_size(allocated_block.size)) != 0)
+                return error::deallocation_failure;
+
+            return error::no_error;
+        }
+
+        error mmap_allocator::deallocate_all()
+        {
+            return error::deallocation_failure;
+        }
+
+        error mmap_allocator::expand(block& allocated_block, size_t delta)
+        {
+            return expand(allocated_block, delta, page_size());
+        }
+
+        error mmap_allocator::expand(block& allocated_block, size_t delta, size_t alignment)
+        {
+            if (allocated_block.ptr == nullptr)
+                return error::null_pointer;
+
+            if (is_power_of_two(alignment) == false)
+                return error::invalid_argument;
+
+            size_t old_length = mapping_size(allocated_block.size);
+            size_t new_length = mapping_size(allocated_block.size + delta);
+
+            if (new_length == old_length ||
+                mremap(allocated_block.ptr, old_length, new_length, 0) != MAP_FAILED) {
+                allocated_block.size += delta;
+                return error::no_error;
+            }
+
+            // The pages after the block are taken, let the kernel move the
+            // mapping. Blocks aligned beyond a page are moved onto a reserved
+            // range with the same alignment.
+            void *ptr = MAP_FAILED;
+
+            if (alignment <= page_size()) {
+                ptr = mremap(allocated_block.ptr, old_length, new_length, MREMAP_MAYMOVE);
+            } else {
+                auto [target, err] = allocate(new_length, alignment);
+                if (err != error::no_error)
+                    return error::allocation_failure;
+
+                ptr = mremap(allocated_block.ptr, old_length, new_length,
+                             MREMAP_MAYMOVE | MREMAP_FIXED, target.ptr);
+
+                if (ptr == MAP_FAILED)
+                    munmap(target.ptr, new_length);
+            }
+
+            if (ptr == MAP_FAILED)
+                return error::allocation_failure;
+
+            allocated_block.ptr   = ptr;
+            allocated_block.size += delta;
+
+            return error::no_error;
+        }
+
+        ret<bool,error> mmap_allocator::owns(block mem_block)
+        {
+            bool aligned = (uintptr_t)mem_block.ptr % page_size() == 0;
+            return {mem_block.ptr != nullptr && aligned, error::no_error};
+        }
+
+        region_allocator::region_allocator(size_t size, huge_page_mode huge_pages)
+                : base(nullptr), reserved(0), committed(0), used(0),
+                  mapping(nullptr), mapping_length(0), mode(huge_page_mode::None), peak(0)
+        {
+            size_t length = align_up(size, huge_page_size);
+
+            if (huge_pages == huge_page_mode::Explicit) {
+                // The huge pages are reserved up front. With MAP_NORESERVE the
+                // mapping would succeed on an empty pool and fault on first touch.
+                void *ptr = map_huge_pages(length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS);
+
+                if (ptr != MAP_FAILED) {
+                    base = (char*)ptr;
+                    reserved = committed = mapping_length = length;
+                    mapping = ptr;
+                    mode = huge_page_mode::Explicit;
+                    return;
+                }
+            }
+
+            // Reserve one extra huge page so the range can be aligned to huge
+            // page boundaries, which lets the kernel use them.
+            void *ptr = mmap(nullptr, length + huge_page_size, PROT_NONE,
+                             MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+
+            if (ptr == MAP_FAILED)
+                return;
+
+            mapping = ptr;
+            mapping_length = length + huge_page_size;
+            base = (char*)align_up((size_t)ptr, huge_page_size);
+            reserved = length;
+
+            if (huge_pages != huge_page_mode::None && advise_huge_pages(base, reserved))
+                mode = huge_page_mode::Transparent;
+        }
+
+        region_allocator::~region_allocator()
+        {
+            if (mapping != nullptr)
+                munmap(mapping, mapping_length);
+        }
+
+        error region_allocator::commit(size_t size)
+        {
+            if (size <= committed)
+                return error::no_error;
+
+            size_t target = align_up(size, huge_page_size);
+            if (target > reserved)
+                target = reserved;
+
+            if (mprotect(base + committed, target - committed, PROT_READ | PROT_WRITE) != 0)
+                return error::allocation_failure;
+
+            committed = target;
+            return error::no_error;
+        }
+
+        ret<block,error> region_allocator::allocate(size_t allocation_size)
+        {
+            return allocate(allocation_size, default_alignment);
+        }
+
+        ret<block,error> region_allocator::allocate(size_t allocation_size, size_t alignment)
+        {
+            if (allocation_size == 0 || is_power_of_two(alignment) == false)
+                return {{nullptr, 0}, error::invalid_argument};
+
+            size_t rounded = align_up(allocation_size, default_alignment);
+            size_t offset  = align_up((size_t)(base + used), alignment) - (size_t)base;
+
+            if (offset > reserved || reserved - offset < rounded)
+                return {{nullptr, 0}, error::allocation_failure};
+
+            auto err = commit(offset + rounded);
+            if (err != error::no_error)
+                return {{nullptr, 0}, err};
+
+            block blk{base + offset, allocation_size};
+            used = offset + rounded;
+
+            return {blk, error::no_error};
+        }
+
+        ret<block,error> region_allocator::allocate_all()
+        {
+            if (used == reserved)
+                return {{nullptr, 0}, error::allocation_failure};
+
+            auto err = commit(reserved);
+            if (err != error::no_error)
+                return {{nullptr, 0}, err};
+
+            block blk{base + used, reserved - used};
+            used = reserved;
+
+            return {blk, error::no_error};
+        }
+
+        error region_allocator::deallocate(block allocated_block)
+        {
+            if (allocated_block.ptr == nullptr)
+                return error::null_pointer;
+
+            auto [owned, err] = owns(allocated_block);
+            if (owned == false)
+                return error::invalid_address;
+
+            size_t rounded = align_up(allocated_block.size, default_alignment);
+
+            if ((char*)allocated_block.ptr + rounded == base + used)
+                used -= rounded;
+
+            return error::no_error;
+        }
+
+        error region_allocator::deallocate_all()
+        {
+            if (used > peak)
+                peak = used;
+
+            used = 0;
+
+            if (decay.elapsed() && mode != huge_page_mode::Explicit && committed > peak) {
+                purge_pages(base + peak, committed - peak);
+                peak = 0;
+            }
+
+            return error::no_error;
+        }
+
+        error region_allocator::expand(block& allocated_block, size_t delta)
+        {
+            if (allocated_block.ptr == nullptr)
+                return error::null_pointer;
+
+            size_t rounded = align_up(allocated_block.size, default_alignment);
+            size_t offset  = (char*)allocated_block.ptr - base;
+
+            if ((char*)allocated_block.ptr + rounded != base + used)
+                return error::allocation_failure;
+
+            size_t expanded = align_up(allocated_block.size + delta, default_alignment);
+
+            if (reserved - offset < expanded)
+                return error::allocation_failure;
+
+            auto err = commit(offset + expanded);
+            if (err != error::no_error)
+                return err;
+
+            used = offset + expanded;
+            allocated_block.size += delta;
+
+            return error::no_error;
+        }
+
+        ret<bool,error> region_allocator::owns(block mem_block)
+        {
+            char *ptr = (char*)mem_block.ptr;
+            return {base != nullptr && ptr >= base && ptr < base + reserved, error::no_error};
+        }
+
+        huge_page_mode region_allocator::get_mode() const
+        {
+            return mode;
+        }
+
+        size_t region_allocator::capacity() const
+        {
+            return reserved;
+        }
+
+        ret<size_t,error> region_allocator::allocate_batch(size_t allocation_size, size_t count, block *out)
+        {
+            if (allocation_size == 0)
+                return {0, error::invalid_argument};
+
+            size_t rounded = align_up(allocation_size, default_alignment);
+            size_t offset  = align_up((size_t)(base + used), default_alignment) - (size_t)base;
+
+            if (count == 0)
+                return {0, error::no_error};
+
+            if (rounded > SIZE_MAX / count || offset > reserved || reserved - offset < rounded * count)
+                return {0, error::allocation_failure};
+
+            auto err = commit(offset + rounded * count);
+            if (err != error::no_error)
+                return {0, err};
+
+            for (size_t i=0; i<count; i++)
+                out[i] = {base + offset + i * rounded, allocation_size};
+
+            used = offset + rounded * count;
+
+            return {count, error::no_error};
+        }
+
+        size_t region_allocator::purge()
+        {
+            // Huge pages from the reserved pool cannot be given back page by page
+            if (mode == huge_page_mode::Explicit || committed <= used)
+                return 0;
+
+            return purge_pages(base + used, committed - used);
+        }
+
+        // Bind the range to a node, preferring it without failing when it is
+        // exhausted. Called before the range is touched.
+        static bool bind_to_node(void *ptr, size_t size, size_t node)
+        {
+            unsigned long mask = 1ul << node;
+            return syscall(SYS_mbind, ptr, size, MPOL_PREFERRED, &mask, numa_allocator::max_nodes + 1, 0) == 0;
+        }
+
+        numa_allocator::numa_allocator(size_t size_per_node, huge_page_mode huge_pages) : bound(false)
+        {
+            size_t count = system_node_count();
+
+            nodes.push_back(std::make_unique<node_region>(size_per_node, huge_pages));
+
+            if (count == 1)
+                return;
+
+            for (size_t node = 1; node < count; node++)
+                nodes.push_back(std::make_unique<node_region>(size_per_node, huge_pages));
+
+            bound = true;
+
+            for (size_t node = 0; node < count && bound; node++) {
+                region_allocator& region = nodes[node]->region;
+
+                if (region.base == nullptr || bind_to_node(region.base, region.reserved, node) == false)
+                    bound = false;
+            }
+
+            // Without binding the regions are all alike, keep only one
+            if (bound == false)
+                nodes.resize(1);
+        }
+
+        ret<block,error> numa_allocator::allocate(size_t allocation_size)
+        {
+            return allocate_on(local_node(), allocation_size, default_alignment);
+        }
+
+        ret<block,error> numa_allocator::allocate(size_t allocation_size, size_t alignment)
+        {
+            return allocate_on(local_node(), allocation_size, alignment);
+        }
+
+        ret<block,error> numa_allocator::allocate_all()
+        {
+            node_region& local = *nodes[local_node()];
+            std::lock_guard<std::mutex> guard(local.lock);
+
+            return local.region.allocate_all();
+        }
+
+        ret<block,error> numa_allocator::allocate_on(size_t node, size_t allocation_size, size_t alignment)
+        {
+            if (node >= nodes.size())
+                return {{nullptr, 0}, error::invalid_argument};
+
+            node_region& target = *nodes[node];
+            std::lock_guard<std::mutex> guard(target.lock);
+
+            return target.region.allocate(allocation_size, alignment);
+        }
+
+        error numa_allocator::deallocate(block allocated_block)
+        {
+            if (allocated_block.ptr == nullptr)
+                return error::null_pointer;
+
+            node_region *owner = find_owner(allocated_block);
+            if (owner == nullptr)
+                return error::invalid_address;
+
+            std::lock_guard<std::mutex> guard(owner->lock);
+            return owner->region.deallocate(allocated_block);
+        }
+
+        error numa_allocator::deallocate_all()
+        {
+            for (auto& node : nodes) {
+                std::lock_guard<std::mutex> guard(node->lock);
+                node->region.deallocate_all();
+            }
+
+            return error::no_error;
+        }
+
+        error numa_allocator::expand(block& allocated_block, size_t delta)
+        {
+            if (allocated_block.ptr == nullptr)
+                return error::null_pointer;
+
+            node_region *owner = find_owner(allocated_block);
+            if (owner == nullptr)
+                return error::invalid_address;
+
+            std::lock_guard<std::mutex> guard(owner->lock);
+            return owner->region.expand(allocated_block, delta);
+        }
+
+        ret<bool,error> numa_allocator::owns(block mem_block)
+        {
+            return {find_owner(mem_block) != nullptr, error::no_error};
+        }
+
+        size_t numa_allocator::node_count() const
+        {
+            return nodes.size();
+        }
+
+        bool numa_allocator::is_bound() const
+        {
+            return bound;
+        }
+
+        size_t numa_allocator::local_node() const
+        {
+            return current_node() % nodes.size();
+        }
+
+        size_t numa_allocator::purge()
+        {
+            size_t total = 0;
+
+            for (auto& node : nodes) {
+                std::lock_guard<std::mutex> guard(node->lock);
+                total += node->region.purge();
+            }
+
+            return total;
+        }
+
+        size_t numa_allocator::system_node_count()
+        {
+            static const size_t count = [] () -> size_t {
+                // The file lists the possible nodes, e.g. "0-1", the last
+                // number is the highest node.
+                FILE *file = fopen("/sys/devices/system/node/possible", "r");
+                if (file == nullptr)
+                    return 1;
+
+                char text[64] = {0};
+                size_t length = fread(text, 1, sizeof(text) - 1, file);
+                fclose(file);
+
+                size_t highest = 0;
+                for (size_t i = 0; i < length; i++) {
+                    if (text[i] >= '0' && text[i] <= '9')
+                        highest = highest * 10 + (text[i] - '0');
+                    else if (text[i] == '-' || text[i] == ',')
+                        highest = 0;
+                }
+
+                size_t nodes = highest + 1;
+                return nodes > max_nodes ? max_nodes : nodes;
+            }();
+
+            return count;
+        }
+
+        size_t numa_allocator::current_node()
+        {
+            unsigned cpu  = 0;
+            unsigned node = 0;
+
+            if (syscall(SYS_getcpu, &cpu, &node, nullptr) != 0)
+                return 0;
+
+            return node;
+        }
+
+        numa_allocator::node_region *numa_allocator::find_owner(block mem_block)
+        {
+            for (auto& node : nodes) {
+                auto [owned, err] = node->region.owns(mem_block);
+                if (owned)
+                    return node.get();
+            }
+
+            return nullptr;
+        }
+
+        // The state of a persistent heap, at the beginning of its file
+        struct persistent_header
+        {
+            char     magic[8];
+            uint64_t size;
+            uint64_t used;
+            uint64_t root;
+            uint64_t free_lists[64];
+        };
+
+        static const char persistent_magic[8] = {'L', 'T', 'D', 'H', 'E', 'A', 'P', '1'};
+
+        // The largest size class a size_t can represent
+        static constexpr size_t persistent_max_class = SIZE_MAX / 2 + 1;
+
+        static size_t persistent_class(size_t size)
+        {
+            size_t size_class = default_alignment;
+
+            while (size_class < size)
+                size_class <<= 1;
+
+            return size_class;
+        }
+
+        static size_t persistent_class_index(size_t size_class)
+        {
+            return __builtin_ctzll(size_class);
+        }
+
+        persistent_allocator::persistent_allocator(const char *path, size_t initial_size, size_t max_size)
+                : file(-1), base(nullptr), mapped(0), reserved(0), created(false)
+        {
+            if (path == nullptr)
+                return;
+
+            file = open(path, O_RDWR | O_CREAT, 0644);
+            if (file == -1)
+                return;
+
+            struct stat status;
+
+            if (flock(file, LOCK_EX | LOCK_NB) != 0 || fstat(file, &status) != 0) {
+                close(file);
+                file = -1;
+                return;
+            }
+
+            persistent_header header;
+            size_t size = status.st_size;
+
+            if (pread(file, &header, sizeof(header), 0) != (ssize_t)sizeof(header) ||
+                memcmp(header.magic, persistent_magic, sizeof(header.magic)) != 0) {
+                // A file shorter than the header is new, or its creation
+                // stopped before the header was written.
+                if (size >= sizeof(header)) {
+                    close(file);
+                    file = -1;
+                    return;
+                }
+
+                memcpy(header.magic, persistent_magic, sizeof(header.magic));
+                header.size = align_up(initial_size > 2 * page_size() ? initial_size : 2 * page_size(), page_size());
+                header.used = page_size();
+                header.root = 0;
+                memset(header.free_lists, 0, sizeof(header.free_lists));
+
+                if (pwrite(file, &header, sizeof(header), 0) != (ssize_t)sizeof(header) || fdatasync(file) != 0) {
+                    close(file);
+                    file = -1;
+                    return;
+                }
+
+                created = true;
+            }
+
+            // The header is written before the file is extended, so a crash
+            // in between leaves a file shorter than its header, extended here.
+            if (header.size < 2 * page_size() || header.size % page_size() != 0 || header.used > header.size ||
+                (header.size > size && ftruncate(file, header.size) != 0)) {
+                close(file);
+                file = -1;
+                return;
+            }
+
+            size = header.size;
+
+            // The file is mapped at the start of a range reserved for its
+            // largest size, so that it grows in place.
+            size_t reservation = align_up(max_size > size ? max_size : size, page_size());
+            void *range = mmap(nullptr, reservation, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+
+            if (range == MAP_FAILED) {
+                close(file);
+                file = -1;
+                return;
+            }
+
+            void *ptr = mmap(range, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, file, 0);
+
+            if (ptr == MAP_FAILED) {
+                munmap(range, reservation);
+                close(file);
+                file = -1;
+                return;
+            }
+
+            base     = (char*)ptr;
+            mapped   = size;
+            reserved = reservation;
+        }
+
+        persistent_allocator::~persistent_allocator()
+        {
+            if (base != nullptr)
+                munmap(base, reserved);
+
+            if (file != -1)
+                close(file);
+        }
+
+        ret<size_t,error> persistent_allocator::take(size_t size_class)
+        {
+            persistent_header *header = (persistent_header*)base;
+            uint64_t& list = header->free_lists[persistent_class_index(size_class)];
+
+            if (list != 0) {
+                size_t offset = list;
+                list = *(uint64_t*)(base + offset);
+                return {offset, error::no_error};
+            }
+
+            // Fresh blocks are aligned to their class, up to the page size
+            size_t alignment = size_class < page_size() ? size_class : page_size();
+            size_t offset    = align_up(header->used, alignment);
+
+            if (offset + size_class > mapped) {
+                auto err = grow(offset + size_class);
+                if (err != error::no_error)
+                    return {0, err};
+            }
+
+            header->used = offset + size_class;
+
+            return {offset, error::no_error};
+        }
+
+        error persistent_allocator::grow(size_t minimum)
+        {
+            if (minimum > reserved)
+                return error::allocation_failure;
+
+            size_t size = mapped;
+
+            while (size < minimum)
+                size *= 2;
+
+            if (size > reserved)
+                size = reserved;
+
+            persistent_header *header = (persistent_header*)base;
+
+            // The header is on the disk before the file is extended, opening
+            // the file again after a crash in between completes the growth.
+            header->size = size;
+
+            if (sync_header() != error::no_error || ftruncate(file, size) != 0) {
+                header->size = mapped;
+                sync_header();
+                return error::allocation_failure;
+            }
+
+            // The new part of the file replaces the reserved pages after the
+            // mapping, which never moves.
+            void *ptr = mmap(base + mapped, size - mapped, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, file, mapped);
+            if (ptr == MAP_FAILED) {
+                header->size = mapped;
+                sync_header();
+                return error::allocation_failure;
+            }
+
+            mapped = size;
+
+            return error::no_error;
+        }
+
+        error persistent_allocator::sync_header()
+        {
+            if (msync(base, page_size(), MS_SYNC) != 0)
+                return error::invalid_operation;
+
+            return error::no_error;
+        }
+
+        ret<block,error> persistent_allocator::allocate(size_t allocation_size)
+        {
+            return allocate(allocation_size, default_alignment);
+        }
+
+        ret<block,error> persistent_allocator::allocate(size_t allocation_size, size_t alignment)
+        {
+            if (allocation_size == 0 || is_power_of_two(alignment) == false)
+                return {{nullptr, 0}, error::invalid_argument};
+
+            if (base == nullptr || alignment > page_size() || allocation_size > persistent_max_class)
+                return {{nullptr, 0}, error::allocation_failure};
+
+            size_t size_class = persistent_class(allocation_size);
+            if (size_class < alignment)
+                size_class = alignment;
+
+            std::lock_guard<std::mutex> guard(lock);
+
+            auto [offset, err] = take(size_class);
+            if (err != error::no_error)
+                return {{nullptr, 0}, err};
+
+            return {{base + offset, allocation_size}, error::no_error};
+        }
+
+        ret<block,error> persistent_allocator::allocate_all()
+        {
+            return {{nullptr, 0}, error::allocation_failure};
+        }
+
+        error persistent_allocator::deallocate(block allocated_block)
+        {
+            if (allocated_block.ptr == nullptr)
+                return error::null_pointer;
+
+            auto [owned, err] = owns(allocated_block);
+            if (owned == false)
+                return error::invalid_address;
+
+            std::lock_guard<std::mutex> guard(lock);
+
+            persistent_header *header = (persistent_header*)base;
+            uint64_t& list = header->free_lists[persistent_class_index(persistent_class(allocated_block.size))];
+
+            *(uint64_t*)allocated_block.ptr = list;
+            list = (char*)allocated_block.ptr - base;
+
+            return error::no_error;
+        }
+
+        error persistent_allocator::deallocate_all()
+        {
+            if (base == nullptr)
+                return error::invalid_operation;
+
+            std::lock_guard<std::mutex> guard(lock);
+
+            persistent_header *header = (persistent_header*)base;
+            header->used = page_size();
+            header->root = 0;
+            memset(header->free_lists, 0, sizeof(header->free_lists));
+
+            return error::no_error;
+        }
+
+        error persistent_allocator::expand(block& allocated_block, size_t delta)
+        {
+            if (allocated_block.ptr == nullptr)
+                return error::null_pointer;
+
+            if (delta > persistent_max_class - allocated_block.size)
+                return error::allocation_failure;
+
+            // Blocks grow in place up to their size class
+            if (persistent_class(allocated_block.size + delta) > persistent_class(allocated_block.size))
+                return error::allocation_failure;
+
+            allocated_block.size += delta;
+            return error::no_error;
+        }
+
+        ret<bool,error> persistent_allocator::owns(block mem_block)
+        {
+            if (base == nullptr)
+                return {false, error::no_error};
+
+            char *ptr = (char*)mem_block.ptr;
+            persistent_header *header = (persistent_header*)base;
+
+            return {ptr >= base + page_size() && ptr < base + header->used, error::no_error};
+        }
+
+        bool persistent_allocator::is_open() const
+        {
+            return base != nullptr;
+        }
+
+        bool persistent_allocator::is_new() const
+        {
+            return created;
+        }
+
+        void *persistent_allocator::get_root() const
+        {
+            if (base == nullptr)
+                return nullptr;
+
+            uint64_t root = ((persistent_header*)base)->root;
+            return root == 0 ? nullptr : base + root;
+        }
+
+        error persistent_allocator::set_root(void *root)
+        {
+            if (base == nullptr)
+                return error::invalid_operation;
+
+            if (root != nullptr) {
+                auto [owned, err] = owns({root, 1});
+                if (owned == false)
+                    return error::invalid_address;
+            }
+
+            ((persistent_header*)base)->root = root == nullptr ? 0 : (char*)root - base;
+
+            return sync_header();
+        }
+
+        size_t persistent_allocator::offset_of(const void *ptr) const
+        {
+            return (const char*)ptr - base;
+        }
+
+        void *persistent_allocator::pointer_to(size_t offset) const
+        {
+            return base + offset;
+        }
+
+        error persistent_allocator::sync()
+        {
+            if (base == nullptr)
+                return error::invalid_operation;
+
+            if (msync(base, mapped, MS_SYNC) != 0)
+                return error::invalid_operation;
+
+            return error::no_error;
+        }
+
+        size_t persistent_allocator::capacity() const
+        {
+            return mapped;
+        }
+
+        struct heap_sample
+        {
+            heap_sample *prev;
+            heap_sample *next;
+            size_t       size;
+            size_t       depth;
+            void        *frames[heap_profiler::max_frames];
+        };
+
+        struct heap_profiler_state
+        {
+            std::mutex   lock;
+            heap_sample *samples = nullptr;
+            size_t       count   = 0;
+
+            std::atomic_bool    dump_requested{false};
+            char                dump_path[256] = {0};
+            heap_profile_format dump_format = heap_profile_format::Pprof;
+        };
+
+        static heap_profiler_state& profiler_state()
+        {
+            static heap_profiler_state state;
+            return state;
+        }
+
+        static thread_local bool     sampling_primed = false;
+        static thread_local uint64_t sampling_random = 0;
+
+        // Draw the distance to the next sample from an exponential distribution
+        // with the given mean, using a thread-local xorshift generator.
+        static int64_t next_sample_distance(size_t mean)
+        {
+            if (sampling_random == 0)
+                sampling_random = ((uintptr_t)&sampling_random * 0x9E3779B97F4A7C15ull) | 1;
+
+            uint64_t x = sampling_random;
+            x ^= x >> 12;
+            x ^= x << 25;
+            x ^= x >> 27;
+            sampling_random = x;
+
+            double uniform  = (double)(((x * 0x2545F4914F6CDD1Dull) >> 11) + 1) / 9007199254740992.0;
+            double distance = -log(uniform) * (double)mean;
+
+            if (distance < 1.0)
+                return 1;
+
+            return distance > 1e18 ? (int64_t)1e18 : (int64_t)distance;
+        }
+
+        void heap_profiler::set_sample_interval(size_t bytes)
+        {
+            interval.store(bytes, std::memory_order_relaxed);
+        }
+
+        size_t heap_profiler::get_sample_interval()
+        {
+            return interval.load(std::memory_order_relaxed);
+        }
+
+        heap_sample *heap_profiler::record(size_t size)
+        {
+            size_t mean = interval.load(std::memory_order_relaxed);
+            if (mean == 0)
+                return nullptr;
+
+            // The countdown of a new thread starts at 0, draw its first distance
+            // instead of sampling its first allocation.
+            if (sampling_primed == false) {
+                sampling_primed = true;
+                bytes_until_sample = next_sample_distance(mean) - (int64_t)size;
+
+                if (bytes_until_sample > 0)
+                    return nullptr;
+            }
+
+            bytes_until_sample = next_sample_distance(mean);
+
+            heap_sample *sample = (heap_sample*)malloc(sizeof(heap_sample));
+            if (sample == nullptr)
+                return nullptr;
+
+            sample->size  = size;
+            sample->depth = 0;
+
+#ifdef __GLIBC__
+            // Skip the frame of record()
+            void *frames[max_frames + 1];
+            int depth = backtrace(frames, max_frames + 1);
+
+            if (depth > 1) {
+                sample->depth = depth - 1;
+                memcpy(sample->frames, frames + 1, sample->depth * sizeof(void*));
+            }
+#endif
+
+            heap_profiler_state& state = profiler_state();
+
+            {
+                std::lock_guard<std::mutex> guard(state.lock);
+
+                sample->prev = nullptr;
+                sample->next = state.samples;
+
+                if (state.samples != nullptr)
+                    state.samples->prev = sample;
+
+                state.samples = sample;
+                state.count++;
+            }
+
+            return sample;
+        }
+
+        void heap_profiler::resize(heap_sample *sample, size_t size)
+        {
+            heap_profiler_state& state = profiler_state();
+            std::lock_guard<std::mutex> guard(state.lock);
+
+            sample->size = size;
+        }
+
+        void heap_profiler::forget(heap_sample *sample)
+        {
+            heap_profiler_state& state = profiler_state();
+
+            {
+                std::lock_guard<std::mutex> guard(state.lock);
+
+                if (sample->prev != nullptr)
+                    sample->prev->next = sample->next;
+                else
+                    state.samples = sample->next;
+
+                if (sample->next != nullptr)
+                    sample->next->prev = sample->prev;
+
+                state.count--;
+            }
+
+            free(sample);
+        }
+
+        size_t heap_profiler::live_samples()
+        {
+            heap_profiler_state& state = profiler_state();
+            std::lock_guard<std::mutex> guard(state.lock);
+
+            return state.count;
+        }
+
+        // Write the frames of a sample outermost first, separated by ';'
+        static void write_folded_stack(FILE *file, const heap_sample *sample)
+        {
+#ifdef __GLIBC__
+            char **symbols = backtrace_symbols((void* const*)sample->frames, (int)sample->depth);
+#else
+            char **symbols = nullptr;
+#endif
+
+            for (size_t i = sample->depth; i > 0; i--) {
+                const char *symbol = symbols != nullptr ? symbols[i - 1] : nullptr;
+                const char *begin  = symbol != nullptr ? strchr(symbol, '(') : nullptr;
+                const char *end    = begin != nullptr ? strpbrk(begin, "+)") : nullptr;
+
+                if (i != sample->depth)
+                    fputc(';', file);
+
+                if (begin == nullptr || end == nullptr || end == begin + 1) {
+                    fprintf(file, "%p", sample->frames[i - 1]);
+                    continue;
+                }
+
+                std::string mangled(begin + 1, end);
+
+                int status = 0;
+                char *demangled = abi::__cxa_demangle(mangled.c_str(), nullptr, nullptr, &status);
+
+                fputs(status == 0 && demangled != nullptr ? demangled : mangled.c_str(), file);
+                free(demangled);
+            }
+
+            free(symbols);
+        }
+
+        // Copy the live samples. The copy is allocated without the lock, since
+        // the allocation may itself be sampled.
+        static std::vector<heap_sample> copy_samples(heap_profiler_state& state)
+        {
+            std::vector<heap_sample> samples;
+
+            for (;;) {
+                size_t count;
+                {
+                    std::lock_guard<std::mutex> guard(state.lock);
+                    count = state.count;
+                }
+
+                samples.reserve(count);
+
+                std::lock_guard<std::mutex> guard(state.lock);
+
+                if (state.count > samples.capacity())
+                    continue;
+
+                for (heap_sample *sample = state.samples; sample != nullptr; sample = sample->next)
+                    samples.push_back(*sample);
+
+                return samples;
+            }
+        }
+
+        error heap_profiler::dump(FILE *file, heap_profile_format format)
+        {
+            if (file == nullptr)
+                return error::null_pointer;
+
+            size_t mean = get_sample_interval();
+            std::vector<heap_sample> samples = copy_samples(profiler_state());
+
+            if (format == heap_profile_format::Folded) {
+                for (const heap_sample& sample : samples) {
+                    // A sample stands for at least the interval it was drawn from
+                    size_t weight = sample.size < mean ? mean : sample.size;
+
+                    write_folded_stack(file, &sample);
+                    fprintf(file, " %zu\n", weight);
+                }
+
+                return error::no_error;
+            }
+
+            size_t total = 0;
+            for (const heap_sample& sample : samples)
+                total += sample.size;
+
+            fprintf(file, "heap profile: %zu: %zu [%zu: %zu] @ heap_v2/%zu\n", samples.size(), total, samples.size(), total, mean);
+
+            for (const heap_sample& sample : samples) {
+                fprintf(file, "1: %zu [1: %zu] @", sample.size, sample.size);
+
+                for (size_t i = 0; i < sample.depth; i++)
+                    fprintf(file, " %p", sample.frames[i]);
+
+                fputc('\n', file);
+            }
+
+            // pprof maps the addresses to the binaries with the mappings
+            fputs("\nMAPPED_LIBRARIES:\n", file);
+
+            FILE *maps = fopen("/proc/self/maps", "r");
+            if (maps != nullptr) {
+                char buffer[4096];
+                size_t length;
+
+                while ((length = fread(buffer, 1, sizeof(buffer), maps)) > 0)
+                    fwrite(buffer, 1, length, file);
+
+                fclose(maps);
+            }
+
+            return error::no_error;
+        }
+
+        error heap_profiler::dump(const char *path, heap_profile_format format)
+        {
+            if (path == nullptr)
+                return error::null_pointer;
+
+            FILE *file = fopen(path, "w");
+            if (file == nullptr)
+                return error::invalid_argument;
+
+            auto err = dump(file, format);
+            fclose(file);
+
+            return err;
+        }
+
+        static void request_heap_dump(int)
+        {
+            profiler_state().dump_requested.store(true, std::memory_order_relaxed);
+        }
+
+        error heap_profiler::dump_on_signal(int signal_number, const char *path, heap_profile_format format)
+        {
+            if (path == nullptr)
+                return error::null_pointer;
+
+            heap_profiler_state& state = profiler_state();
+
+            if (strlen(path) >= sizeof(state.dump_path))
+                return error::invalid_argument;
+
+            {
+                std::lock_guard<std::mutex> guard(state.lock);
+
+                strcpy(state.dump_path, path);
+                state.dump_format = format;
+            }
+
+            struct sigaction action;
+            memset(&action, 0, sizeof(action));
+            action.sa_handler = request_heap_dump;
+            action.sa_flags   = SA_RESTART;
+            sigemptyset(&action.sa_mask);
+
+            if (sigaction(signal_number, &action, nullptr) != 0)
+                return error::invalid_operation;
+
+            return error::no_error;
+        }
+
+        void heap_profiler::poll()
+        {
+            heap_profiler_state& state = profiler_state();
+
+            if (state.dump_requested.exchange(false, std::memory_order_relaxed) == false)
+                return;
+
+            char path[sizeof(state.dump_path)];
+            heap_profile_format format;
+
+            {
+                std::lock_guard<std::mutex> guard(state.lock);
+
+                memcpy(path, state.dump_path, sizeof(path));
+                format = state.dump_format;
+            }
+
+            dump(path, format);
+        }
+
+        // The header of trace files, followed by the records
+        struct trace_header
+        {
+            char     magic[8];
+            uint32_t version;
+            uint32_t record_size;
+        };
+
+        static const char   trace_magic[8]      = {'L', 'T', 'D', 'T', 'R', 'A', 'C', 'E'};
+        static const size_t trace_buffer_length = 4096;
+
+        static uint64_t trace_clock()
+        {
+            auto now = std::chrono::steady_clock::now().time_since_epoch();
+            return std::chrono::duration_cast<std::chrono::nanoseconds>(now).count();
+        }
+
+        static uint32_t trace_thread()
+        {
+            static std::atomic_uint32_t next_thread{0};
+            static thread_local uint32_t thread = next_thread.fetch_add(1, std::memory_order_relaxed);
+
+            return thread;
+        }
+
+        allocation_trace::allocation_trace(const char *path) : file(nullptr), start(trace_clock())
+        {
+            if (path == nullptr)
+                return;
+
+            file = fopen(path, "wb");
+            if (file == nullptr)
+                return;
+
+            trace_header header;
+            memcpy(header.magic, trace_magic, sizeof(header.magic));
+            header.version     = 1;
+            header.record_size = sizeof(trace_record);
+
+            fwrite(&header, sizeof(header), 1, file);
+            buffer.reserve(trace_buffer_length);
+        }
+
+        allocation_trace::~allocation_trace()
+        {
+            if (global_trace.load() == this)
+                global_trace.store(nullptr);
+
+            if (file == nullptr)
+                return;
+
+            flush();
+            fclose(file);
+        }
+
+        bool allocation_trace::is_open() const
+        {
+            return file != nullptr;
+        }
+
+        void allocation_trace::record(trace_operation operation, const void *address, size_t size, size_t alignment,
+                                      const void *origin)
+        {
+            if (file == nullptr)
+                return;
+
+            trace_record rec;
+            rec.timestamp      = trace_clock() - start;
+            rec.address        = (uintptr_t)address;
+            rec.origin         = (uintptr_t)origin;
+            rec.size           = size;
+            rec.thread         = trace_thread();
+            rec.operation      = (uint8_t)operation;
+            rec.alignment_log2 = (uint8_t)__builtin_ctzll(alignment);
+            rec.reserved       = 0;
+
+            std::lock_guard<std::mutex> guard(lock);
+
+            buffer.push_back(rec);
+
+            if (buffer.size() == trace_buffer_length) {
+                fwrite(buffer.data(), sizeof(trace_record), buffer.size(), file);
+                buffer.clear();
+            }
+        }
+
+        error allocation_trace::flush()
+        {
+            if (file == nullptr)
+                return error::invalid_operation;
+
+            std::lock_guard<std::mutex> guard(lock);
+
+            size_t written = fwrite(buffer.data(), sizeof(trace_record), buffer.size(), file);
+            bool complete  = written == buffer.size();
+
+            buffer.clear();
+
+            if (fflush(file) != 0 || complete == false)
+                return error::invalid_operation;
+
+            return error::no_error;
+        }
+
+        ret<std::vector<trace_record>,error> allocation_trace::load(const char *path)
+        {
+            std::vector<trace_record> records;
+
+            if (path == nullptr)
+                return {records, error::null_pointer};
+
+            FILE *file = fopen(path, "rb");
+            if (file == nullptr)
+                return {records, error::invalid_argument};
+
+            trace_header header;
+            bool valid = fread(&header, sizeof(header), 1, file) == 1 &&
+                         memcmp(header.magic, trace_magic, sizeof(header.magic)) == 0 &&
+                         header.version == 1 && header.record_size == sizeof(trace_record);
+
+            if (valid == false) {
+                fclose(file);
+                return {records, error::invalid_argument};
+            }
+
+            trace_record chunk[256];
+            size_t count;
+
+            while ((count = fread(chunk, sizeof(trace_record), sizeof(chunk) / sizeof(chunk[0]), file)) > 0)
+                records.insert(records.end(), chunk, chunk + count);
+
+            fclose(file);
+
+            return {records, error::no_error};
+        }
+
+        allocation_trace *allocation_trace::global()
+        {
+            return global_trace.load(std::memory_order_acquire);
+        }
+
+        void allocation_trace::set_global(allocation_trace *trace)
+        {
+            global_trace.store(trace, std::memory_order_release);
         }
     }
 }
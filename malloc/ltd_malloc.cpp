@@ -0,0 +1,398 @@
+/**************************************************************************************
+ * Filename: ltd_malloc.cpp
+ * Description: libltd_malloc.so
+ * Replaces malloc, free, calloc, realloc and the aligned allocation functions
+ * of the C library with an ltd allocator composition. Load it into any process
+ * with LD_PRELOAD, or link it into a binary:
+ *
+ *      LD_PRELOAD=/usr/local/lib/libltd_malloc.so ./server
+ *
+ * Every block carries a 16 byte header in front of the returned pointer, which
+ * holds the size of the underlying block and the distance from its start. Sizes
+ * of up to 1 KiB are served from per-thread magazines over size class
+ * freelists, sizes of up to 1 MiB from freelists under the lock of the thread
+ * cache, and larger ones are mapped directly. Freed blocks stay cached for
+ * their size class. Past a bound per class, the pages of freed blocks of up to
+ * 64 KiB go back to the kernel and larger blocks are unmapped. The lock of the
+ * thread cache is held across fork(), so the children of multithreaded
+ * processes can allocate.
+ *
+ **************************************************************************************/
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <new>
+
+#include "memory.h"
+
+#define LTD_MALLOC_EXPORT extern "C" __attribute__((visibility("default")))
+
+using namespace ltd;
+
+namespace
+{
+    /**
+     * Stateless handle to a region that is reserved once and never unmapped,
+     * so blocks stay valid while other libraries free them at exit. Blocks are
+     * only ever freed to the freelists above it.
+     */
+    struct system_region
+    {
+        static constexpr size_t reservation = 64ul << 30;
+
+        static memory::region_allocator& region()
+        {
+            alignas(memory::region_allocator) static char storage[sizeof(memory::region_allocator)];
+            static memory::region_allocator *instance = new (storage) memory::region_allocator(reservation);
+
+            return *instance;
+        }
+
+        ret<memory::block,error> allocate(size_t allocation_size)
+        {
+            return region().allocate(allocation_size);
+        }
+
+        ret<memory::block,error> allocate(size_t allocation_size, size_t alignment)
+        {
+            return region().allocate(allocation_size, alignment);
+        }
+
+        ret<memory::block,error> allocate_all()
+        {
+            return {{nullptr, 0}, error::allocation_failure};
+        }
+
+        error deallocate(memory::block allocated_block)
+        {
+            return region().deallocate(allocated_block);
+        }
+
+        error deallocate_all()
+        {
+            return error::invalid_operation;
+        }
+
+        error expand(memory::block& allocated_block, size_t delta)
+        {
+            return region().expand(allocated_block, delta);
+        }
+
+        ret<bool,error> owns(memory::block mem_block)
+        {
+            return region().owns(mem_block);
+        }
+    };
+
+    // The region cannot take blocks back, so its pools keep every freed block
+    template<size_t Lo, size_t Hi>
+    using pool = memory::freelist<system_region, Lo, Hi, SIZE_MAX>;
+
+    /**
+     * Pool of page sized blocks over the region. Only the last hot_blocks
+     * freed blocks keep their pages, the pages of the others are given back
+     * to the kernel as soon as they are freed.
+     */
+    template<size_t Lo, size_t Hi>
+    struct page_pool : pool<Lo, Hi>
+    {
+        static constexpr size_t hot_blocks = 64;
+
+        error deallocate(memory::block allocated_block)
+        {
+            auto err = pool<Lo, Hi>::deallocate(allocated_block);
+
+            // A freed block of the window is the head of the list, its first
+            // bytes hold the link.
+            if (err == error::no_error && allocated_block.size >= Lo && this->cached() > hot_blocks)
+                memory::purge_pages((char*)allocated_block.ptr + sizeof(void*), Hi - sizeof(void*));
+
+            return err;
+        }
+
+        error deallocate_batch(memory::block *blocks, size_t block_count)
+        {
+            error result = error::no_error;
+
+            for (size_t i=0; i<block_count; i++) {
+                auto err = deallocate(blocks[i]);
+                if (result == error::no_error)
+                    result = err;
+            }
+
+            return result;
+        }
+    };
+
+    // Large blocks are mapped, and those freed beyond a few per size class
+    // are unmapped, so that their memory serves any size again.
+    template<size_t Lo, size_t Hi>
+    using mapped_pool = memory::freelist<memory::mmap_allocator, Lo, Hi, 8>;
+
+    // The composition behind malloc. It draws memory from the kernel only,
+    // never from the C library, whose malloc this library replaces.
+    using small_heap  = memory::bucketizer<pool, 0, 1024, 16>;
+    using medium_heap = memory::segregator<4096, memory::bucketizer<pool, 1024, 4096, 512>,
+                        memory::segregator<65536, memory::bucketizer<page_pool, 4096, 65536, 4096>,
+                                                  memory::bucketizer<mapped_pool, 65536, 1048576, 65536>>>;
+    using cached_heap = memory::thread_cache_allocator<memory::segregator<1024, small_heap, medium_heap>, 1024, 32>;
+    using malloc_heap = memory::segregator<1048576, cached_heap, memory::mmap_allocator>;
+
+    // The lock of the thread cache guards every tier below it. It is held
+    // across fork(), so that the child never inherits it from a thread that
+    // does not exist there.
+    void prepare_fork()
+    {
+        cached_heap::lock_parent();
+    }
+
+    void release_fork()
+    {
+        cached_heap::unlock_parent();
+    }
+
+    malloc_heap& heap()
+    {
+        alignas(malloc_heap) static char storage[sizeof(malloc_heap)];
+        static malloc_heap *instance = [] () {
+            malloc_heap *created = new (storage) malloc_heap();
+            pthread_atfork(prepare_fork, release_fork, release_fork);
+            return created;
+        }();
+
+        return *instance;
+    }
+
+    struct header
+    {
+        size_t size;
+        size_t offset;
+    };
+
+    static_assert(sizeof(header) == memory::default_alignment, "The header must keep blocks aligned");
+
+    // Blocks allocated while the thread is already inside the allocator, for
+    // instance by the C library registering the destructor of the thread
+    // cache, are mapped directly. The flag in their offset tells free().
+    constexpr size_t mapped_flag = (size_t)1 << (sizeof(size_t) * 8 - 1);
+
+    thread_local bool busy = false;
+
+    header *header_of(void *ptr)
+    {
+        return (header*)ptr - 1;
+    }
+
+    memory::block block_of(void *ptr)
+    {
+        header *h = header_of(ptr);
+        return {(char*)ptr - (h->offset & ~mapped_flag), h->size};
+    }
+
+    void *allocate(size_t size, size_t alignment)
+    {
+        if (alignment < memory::default_alignment)
+            alignment = memory::default_alignment;
+
+        size_t padding = alignment > memory::default_alignment ? alignment : 0;
+        size_t total   = size + sizeof(header) + padding;
+
+        if (total < size) {
+            errno = ENOMEM;
+            return nullptr;
+        }
+
+        memory::block blk{nullptr, 0};
+        bool mapped = busy;
+
+        if (mapped) {
+            memory::mmap_allocator direct;
+            std::tie(blk, std::ignore) = direct.allocate(total);
+        } else {
+            busy = true;
+            std::tie(blk, std::ignore) = heap().allocate(total);
+            busy = false;
+        }
+
+        // The error statics may not be constructed yet when the C library
+        // allocates early, so the pointer is what tells the outcome.
+        if (blk.ptr == nullptr) {
+            errno = ENOMEM;
+            return nullptr;
+        }
+
+        char *ptr = (char*)memory::align_up((size_t)blk.ptr + sizeof(header), alignment);
+
+        header *h = header_of(ptr);
+        h->size   = blk.size;
+        h->offset = (ptr - (char*)blk.ptr) | (mapped ? mapped_flag : 0);
+
+        return ptr;
+    }
+
+    void deallocate(void *ptr)
+    {
+        if (ptr == nullptr)
+            return;
+
+        memory::block blk = block_of(ptr);
+
+        if (header_of(ptr)->offset & mapped_flag) {
+            memory::mmap_allocator direct;
+            direct.deallocate(blk);
+            return;
+        }
+
+        bool nested = busy;
+
+        busy = true;
+        heap().deallocate(blk);
+        busy = nested;
+    }
+
+    size_t usable_size(void *ptr)
+    {
+        header *h = header_of(ptr);
+        return h->size - (h->offset & ~mapped_flag);
+    }
+
+    void *reallocate(void *ptr, size_t size)
+    {
+        if (ptr == nullptr)
+            return allocate(size, memory::default_alignment);
+
+        if (size == 0) {
+            deallocate(ptr);
+            return nullptr;
+        }
+
+        size_t usable = usable_size(ptr);
+        header *h = header_of(ptr);
+
+        // A block shrunk to half of its size or less moves to a smaller size
+        // class, which gives the rest of the block back.
+        if (size <= usable) {
+            if (size + sizeof(header) > h->size / 2)
+                return ptr;
+
+            void *fresh = allocate(size, memory::default_alignment);
+            if (fresh == nullptr)
+                return ptr;
+
+            memcpy(fresh, ptr, size);
+            deallocate(ptr);
+
+            return fresh;
+        }
+
+        // Grow in place when the allocator can, the mapped tier may move the
+        // block along with its header.
+
+        // A size near SIZE_MAX would wrap the size of the underlying block
+        if ((h->offset & mapped_flag) == 0 && busy == false && size - usable <= SIZE_MAX - h->size) {
+            size_t offset = h->offset;
+            memory::block blk = block_of(ptr);
+
+            busy = true;
+            bool expanded = heap().expand(blk, size - usable) == error::no_error;
+            busy = false;
+
+            if (expanded) {
+                char *moved = (char*)blk.ptr + offset;
+                header_of(moved)->size = blk.size;
+                return moved;
+            }
+        }
+
+        void *fresh = allocate(size, memory::default_alignment);
+        if (fresh == nullptr)
+            return nullptr;
+
+        memcpy(fresh, ptr, usable);
+        deallocate(ptr);
+
+        return fresh;
+    }
+}
+
+LTD_MALLOC_EXPORT void *malloc(size_t size)
+{
+    return allocate(size, memory::default_alignment);
+}
+
+LTD_MALLOC_EXPORT void free(void *ptr)
+{
+    deallocate(ptr);
+}
+
+LTD_MALLOC_EXPORT void *calloc(size_t count, size_t size)
+{
+    size_t total = count * size;
+
+    if (size != 0 && total / size != count) {
+        errno = ENOMEM;
+        return nullptr;
+    }
+
+    void *ptr = allocate(total, memory::default_alignment);
+    if (ptr != nullptr)
+        memset(ptr, 0, total);
+
+    return ptr;
+}
+
+LTD_MALLOC_EXPORT void *realloc(void *ptr, size_t size)
+{
+    return reallocate(ptr, size);
+}
+
+LTD_MALLOC_EXPORT int posix_memalign(void **out, size_t alignment, size_t size)
+{
+    if (memory::is_power_of_two(alignment) == false || alignment % sizeof(void*) != 0)
+        return EINVAL;
+
+    // The error is returned, errno is left as it was
+    int saved = errno;
+
+    void *ptr = allocate(size, alignment);
+    if (ptr == nullptr) {
+        errno = saved;
+        return ENOMEM;
+    }
+
+    *out = ptr;
+    return 0;
+}
+
+LTD_MALLOC_EXPORT void *aligned_alloc(size_t alignment, size_t size)
+{
+    if (memory::is_power_of_two(alignment) == false) {
+        errno = EINVAL;
+        return nullptr;
+    }
+
+    return allocate(size, alignment);
+}
+
+LTD_MALLOC_EXPORT void *memalign(size_t alignment, size_t size)
+{
+    return aligned_alloc(alignment, size);
+}
+
+LTD_MALLOC_EXPORT void *valloc(size_t size)
+{
+    return allocate(size, memory::page_size());
+}
+
+LTD_MALLOC_EXPORT void *pvalloc(size_t size)
+{
+    return allocate(memory::align_up(size, memory::page_size()), memory::page_size());
+}
+
+LTD_MALLOC_EXPORT size_t malloc_usable_size(void *ptr)
+{
+    return ptr == nullptr ? 0 : usable_size(ptr);
+}
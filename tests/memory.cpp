@@ -0,0 +1,1585 @@
+#include <iostream>
+#include <map>
+#include <memory_resource>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+#include <errno.h>
+#include <fcntl.h>
+#include <malloc.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <ltd.h>
+
+using namespace ltd;
+
+int allocations   = 0;
+int deallocations = 0;
+
+class counting_allocator
+{
+    memory::heap_allocator allocator;
+public:
+    ret<memory::block,error> allocate(size_t allocation_size)
+    {
+        allocations++;
+        return allocator.allocate(allocation_size);
+    }
+
+    ret<memory::block,error> allocate_all()
+    {
+        return allocator.allocate_all();
+    }
+
+    error deallocate(memory::block allocated_block)
+    {
+        deallocations++;
+        return allocator.deallocate(allocated_block);
+    }
+
+    error deallocate_all()
+    {
+        return allocator.deallocate_all();
+    }
+
+    error expand(memory::block& allocated_block, size_t delta)
+    {
+        return allocator.expand(allocated_block, delta);
+    }
+
+    ret<bool,error> owns(memory::block mem_block)
+    {
+        return allocator.owns(mem_block);
+    }
+};
+
+struct alignas(64) cache_line
+{
+    int value;
+
+    cache_line(int v) : value(v) {}
+};
+
+bool is_aligned(const void *ptr, size_t alignment)
+{
+    return (size_t)ptr % alignment == 0;
+}
+
+int moves     = 0;
+int destroyed = 0;
+
+struct tracked
+{
+    int value;
+
+    tracked(int v) : value(v) {}
+    tracked(tracked&& other) : value(other.value) { moves++; }
+    ~tracked() { destroyed++; }
+};
+
+template<size_t Lo, size_t Hi>
+using counting_pool = memory::freelist<counting_allocator, Lo, Hi, 8>;
+
+/**
+ * Run by the preloaded malloc test in a child process. Prints the errno left
+ * by each failing call.
+ */
+static int malloc_failures()
+{
+    // Volatile so the compiler cannot fold the calls away
+    volatile size_t huge = SIZE_MAX;
+    volatile size_t odd  = 24;
+
+    errno = 0;
+    void *ptr = malloc(huge / 4);
+    int malloc_errno = ptr == nullptr ? errno : 0;
+
+    errno = 0;
+    ptr = calloc(huge / 2, 4);
+    int calloc_errno = ptr == nullptr ? errno : 0;
+
+    ptr = malloc(16);
+    errno = 0;
+    void *grown = realloc(ptr, huge - 8);
+    int realloc_errno = grown == nullptr ? errno : 0;
+    free(grown == nullptr ? ptr : grown);
+
+    errno = 0;
+    ptr = aligned_alloc(odd, 64);
+    int aligned_errno = ptr == nullptr ? errno : 0;
+
+    errno = 0;
+    ptr = memalign(odd, 64);
+    int memalign_errno = ptr == nullptr ? errno : 0;
+
+    printf("%d %d %d %d %d\n", malloc_errno, calloc_errno, realloc_errno, aligned_errno, memalign_errno);
+    return 0;
+}
+
+/**
+ * Run by the preloaded malloc test in a child process. Forks while other
+ * threads allocate medium blocks under the lock of the thread cache, and
+ * prints the number of children that could allocate.
+ */
+static int malloc_forks()
+{
+    std::atomic_bool done{false};
+    std::vector<std::thread> threads;
+
+    for (int i=0; i<4; i++) {
+        threads.emplace_back([&done] () {
+            while (done.load() == false) {
+                void *ptr = malloc(2000);
+                free(ptr);
+            }
+        });
+    }
+
+    int succeeded = 0;
+
+    for (int i=0; i<50; i++) {
+        pid_t pid = fork();
+
+        if (pid == 0) {
+            // A deadlocked child is killed instead of hanging the test
+            alarm(5);
+            void *ptr = malloc(2000);
+            free(ptr);
+            _exit(ptr != nullptr ? 0 : 1);
+        }
+
+        int status = 0;
+        if (pid > 0 && waitpid(pid, &status, 0) == pid && WIFEXITED(status) && WEXITSTATUS(status) == 0)
+            succeeded++;
+    }
+
+    done = true;
+    for (auto& thread : threads)
+        thread.join();
+
+    printf("%d\n", succeeded);
+    return 0;
+}
+
+/**
+ * Run by the preloaded malloc test in a child process. Prints whether freed
+ * large blocks left the resident set and whether a shrunk block moved to a
+ * smaller size class.
+ */
+static int malloc_releases()
+{
+    auto resident = [] () -> size_t {
+        size_t size = 0, pages = 0;
+        FILE *statm = fopen("/proc/self/statm", "r");
+
+        if (statm != nullptr) {
+            if (fscanf(statm, "%zu %zu", &size, &pages) != 2)
+                pages = 0;
+            fclose(statm);
+        }
+
+        return pages * memory::page_size();
+    };
+
+    std::vector<void*> blocks(256);
+    size_t before = resident();
+
+    for (auto& ptr : blocks) {
+        ptr = malloc(256 << 10);
+        memset(ptr, 1, 256 << 10);
+    }
+
+    size_t used = resident() - before;
+
+    for (auto ptr : blocks)
+        free(ptr);
+
+    bool released = resident() < before + used / 4;
+
+    void *ptr = malloc(200000);
+    ptr = realloc(ptr, 100);
+    bool shrunk = ptr != nullptr && malloc_usable_size(ptr) < 1024;
+    free(ptr);
+
+    printf("%d %d\n", released, shrunk);
+    return 0;
+}
+
+auto main(int argc, char** argv) -> int
+{
+    if (getenv("LTD_MALLOC_FAILURES") != nullptr)
+        return malloc_failures();
+
+    if (getenv("LTD_MALLOC_FORKS") != nullptr)
+        return malloc_forks();
+
+    if (getenv("LTD_MALLOC_RELEASES") != nullptr)
+        return malloc_releases();
+
+    test_unit tu;
+
+    tu.test([&tu] () -> void {
+        memory::arena_allocator arena(1024);
+
+        auto [b1, e1] = arena.allocate(10);
+        auto [b2, e2] = arena.allocate(100);
+        tu.expect(e1 == error::no_error && e2 == error::no_error, "Step 1 allocation failed");
+        tu.expect(b1.size == 10 && b2.size == 100, "Step 2 block size mismatch");
+        tu.expect((size_t)b1.ptr % memory::default_alignment == 0, "Step 3 block 1 is misaligned");
+        tu.expect((size_t)b2.ptr % memory::default_alignment == 0, "Step 4 block 2 is misaligned");
+        tu.expect((char*)b2.ptr == (char*)b1.ptr + memory::align_up(10, memory::default_alignment),
+                  "Step 5 blocks are not contiguous");
+
+        memset(b1.ptr, 0xaa, b1.size);
+        memset(b2.ptr, 0xbb, b2.size);
+
+        auto [owned, oe] = arena.owns(b2);
+        tu.expect(owned == true, "Step 6 arena does not own its block");
+
+        int local = 0;
+        auto [foreign, fe] = arena.owns({&local, sizeof(local)});
+        tu.expect(foreign == false, "Step 7 arena owns a foreign block");
+    });
+
+    tu.test([&tu] () -> void {
+        memory::arena_allocator arena(256);
+
+        // The last block can be given back and reused
+        auto [b1, e1] = arena.allocate(32);
+        auto [b2, e2] = arena.allocate(32);
+        arena.deallocate(b2);
+        auto [b3, e3] = arena.allocate(32);
+        tu.expect(b3.ptr == b2.ptr, "Step 1 last block was not reused");
+
+        // The last block can grow in place, others cannot
+        tu.expect(arena.expand(b3, 64) == error::no_error, "Step 2 last block did not expand");
+        tu.expect(b3.size == 96, "Step 3 expanded size mismatch");
+        tu.expect(arena.expand(b1, 16) == error::allocation_failure, "Step 4 inner block expanded");
+
+        // Oversized requests get their own region
+        auto [big, be] = arena.allocate(4096);
+        tu.expect(be == error::no_error && big.size == 4096, "Step 5 oversized allocation failed");
+        memset(big.ptr, 0, big.size);
+
+        auto [b4, e4] = arena.allocate(16);
+        tu.expect((char*)b4.ptr == (char*)b3.ptr + 96, "Step 6 current region was abandoned");
+    });
+
+    tu.test([&tu] () -> void {
+        memory::arena_allocator arena(128);
+
+        void *first = nullptr;
+        for (int i=0; i<32; i++) {
+            auto [blk, err] = arena.allocate(48);
+            tu.expect(err == error::no_error, "Step 1 allocation failed");
+            if (i == 0)
+                first = blk.ptr;
+        }
+
+        tu.expect(arena.deallocate_all() == error::no_error, "Step 2 deallocate_all failed");
+
+        auto [owned, oe] = arena.owns({first, 48});
+        tu.expect(owned == false, "Step 3 released region is still owned");
+
+        auto [blk, err] = arena.allocate(48);
+        tu.expect(err == error::no_error, "Step 4 allocation after reset failed");
+
+        auto [rest, re] = arena.allocate_all();
+        tu.expect(re == error::no_error && rest.size == 128 - 48,
+                  "Step 5 allocate_all did not return the rest of the region");
+    });
+
+    tu.test([&tu] () -> void {
+        memory::stack_allocator<256> stack;
+
+        auto [b1, e1] = stack.allocate(20);
+        auto [b2, e2] = stack.allocate(20);
+        tu.expect(e1 == error::no_error && e2 == error::no_error, "Step 1 allocation failed");
+        tu.expect(stack.available() == 256 - 64, "Step 2 available size mismatch");
+
+        // Out of order frees are deferred until the top is freed
+        stack.deallocate(b1);
+        tu.expect(stack.available() == 256 - 64, "Step 3 inner block was released");
+
+        tu.expect(stack.expand(b2, 100) == error::no_error, "Step 4 top block did not expand");
+        tu.expect(stack.expand(b1, 10) == error::allocation_failure, "Step 5 inner block expanded");
+        tu.expect(stack.expand(b2, 1000) == error::allocation_failure, "Step 6 expanded past capacity");
+
+        stack.deallocate(b2);
+        tu.expect(stack.available() == 256 - 32, "Step 7 top block was not released");
+
+        auto [big, be] = stack.allocate(512);
+        tu.expect(be == error::allocation_failure, "Step 8 allocated past capacity");
+
+        int local = 0;
+        tu.expect(stack.deallocate({&local, sizeof(local)}) == error::invalid_address,
+                  "Step 9 released a foreign block");
+    });
+
+    tu.test([&tu] () -> void {
+        char buffer[1000];
+        memory::stack_allocator<0> stack(buffer + 1, sizeof(buffer) - 1);
+
+        auto [b1, e1] = stack.allocate(64);
+        tu.expect(e1 == error::no_error, "Step 1 allocation failed");
+        tu.expect((size_t)b1.ptr % memory::default_alignment == 0, "Step 2 block is misaligned");
+        tu.expect((char*)b1.ptr > buffer && (char*)b1.ptr < buffer + sizeof(buffer),
+                  "Step 3 block is outside of the supplied storage");
+
+        auto mark = stack.save();
+        for (int i=0; i<4; i++)
+            stack.allocate(100);
+        tu.expect(stack.save() > mark, "Step 4 marker did not move");
+
+        tu.expect(stack.restore(mark) == error::no_error, "Step 5 restore failed");
+        tu.expect(stack.save() == mark, "Step 6 stack was not rolled back");
+        tu.expect(stack.restore(mark + 16) == error::invalid_argument, "Step 7 restored above the top");
+
+        auto [b2, e2] = stack.allocate(64);
+        tu.expect((char*)b2.ptr == (char*)b1.ptr + 64, "Step 8 rolled back space was not reused");
+    });
+
+    tu.test([&tu] () -> void {
+        {
+            memory::freelist<counting_allocator, 16, 64, 2> list;
+
+            auto [b1, e1] = list.allocate(24);
+            auto [b2, e2] = list.allocate(64);
+            auto [b3, e3] = list.allocate(40);
+            tu.expect(allocations == 3, "Step 1 allocations = 3");
+            tu.expect(b1.size == 24 && b2.size == 64 && b3.size == 40, "Step 2 block size mismatch");
+
+            list.deallocate(b1);
+            list.deallocate(b2);
+            list.deallocate(b3);
+            tu.expect(list.cached() == 2, "Step 3 cached = 2");
+            tu.expect(deallocations == 1, "Step 4 deallocations = 1");
+
+            // Any request in the window is served from the cache
+            auto [b4, e4] = list.allocate(16);
+            auto [b5, e5] = list.allocate(50);
+            tu.expect(allocations == 3, "Step 5 allocations = 3");
+            tu.expect(b4.ptr == b2.ptr && b5.ptr == b1.ptr, "Step 6 cached blocks were not recycled");
+            memset(b5.ptr, 0, 64);
+
+            tu.expect(list.expand(b5, 14) == error::no_error, "Step 7 block did not expand to MaxSize");
+            tu.expect(list.expand(b5, 1) == error::allocation_failure, "Step 8 block expanded past MaxSize");
+
+            // Requests outside of the window go to the parent
+            auto [b6, e6] = list.allocate(128);
+            list.deallocate(b6);
+            tu.expect(allocations == 4 && deallocations == 2, "Step 9 large block was cached");
+
+            list.deallocate(b4);
+            list.deallocate(b5);
+        }
+        tu.expect(allocations == deallocations, "Step 10 cached blocks leaked");
+    });
+
+    tu.test([&tu] () -> void {
+        memory::fallback_allocator<memory::stack_allocator<128>, counting_allocator> allocator;
+        auto& stack = allocator.get_primary();
+
+        auto [b1, e1] = allocator.allocate(64);
+        auto [b2, e2] = allocator.allocate(64);
+        tu.expect(allocations == 0 && stack.available() == 0, "Step 1 primary was not used");
+
+        auto [b3, e3] = allocator.allocate(64);
+        tu.expect(e3 == error::no_error && allocations == 1, "Step 2 fallback was not used");
+
+        auto [owned, oe] = allocator.owns(b3);
+        tu.expect(owned == true, "Step 3 fallback block is not owned");
+
+        // Deallocation is routed by the primary's owns()
+        allocator.deallocate(b3);
+        tu.expect(deallocations == 1, "Step 4 fallback block was not released");
+
+        allocator.deallocate(b2);
+        tu.expect(deallocations == 1 && stack.available() == 64, "Step 5 primary block was not released");
+
+        tu.expect(allocator.expand(b1, 10) == error::no_error, "Step 6 top block did not expand");
+    });
+
+    tu.test([&tu] () -> void {
+        memory::segregator<64, memory::stack_allocator<256>, counting_allocator> allocator;
+        auto& small = allocator.get_small();
+
+        auto [b1, e1] = allocator.allocate(64);
+        auto [b2, e2] = allocator.allocate(65);
+        tu.expect(small.available() == 192, "Step 1 small request was not routed to small");
+        tu.expect(allocations == 1, "Step 2 large request was not routed to large");
+
+        tu.expect(allocator.expand(b1, 1) == error::allocation_failure, "Step 3 expanded across the threshold");
+
+        allocator.deallocate(b2);
+        allocator.deallocate(b1);
+        tu.expect(deallocations == 1 && small.available() == 256, "Step 4 deallocation misrouted");
+
+        memory::heap_allocator heap;
+        auto [owned, oe] = heap.owns(b2);
+        auto [null_owned, ne] = heap.owns({nullptr, 0});
+        tu.expect(owned == true && oe == error::no_error, "Step 5 heap does not own a block");
+        tu.expect(null_owned == false, "Step 6 heap owns a null block");
+    });
+
+    tu.test([&tu] () -> void {
+        {
+            using allocator_type = memory::bucketizer<counting_pool, 0, 64, 16>;
+            allocator_type allocator;
+
+            tu.expect(allocator_type::bucket_count == 4, "Step 1 bucket_count = 4");
+
+            auto [b1, e1] = allocator.allocate(1);
+            auto [b2, e2] = allocator.allocate(17);
+            auto [b3, e3] = allocator.allocate(64);
+            tu.expect(e1 == error::no_error && e2 == error::no_error && e3 == error::no_error,
+                      "Step 2 allocation failed");
+
+            auto [b4, e4] = allocator.allocate(65);
+            auto [b5, e5] = allocator.allocate(0);
+            tu.expect(e4 == error::allocation_failure && e5 == error::allocation_failure,
+                      "Step 3 allocated outside of the range");
+
+            allocator.deallocate(b1);
+            allocator.deallocate(b2);
+            allocator.deallocate(b3);
+            tu.expect(allocator.get_bucket<0>().cached() == 1, "Step 4 bucket 0 cached = 1");
+            tu.expect(allocator.get_bucket<1>().cached() == 1, "Step 5 bucket 1 cached = 1");
+            tu.expect(allocator.get_bucket<2>().cached() == 0, "Step 6 bucket 2 cached = 0");
+            tu.expect(allocator.get_bucket<3>().cached() == 1, "Step 7 bucket 3 cached = 1");
+
+            // Same class requests are recycled from their own bucket
+            auto [b6, e6] = allocator.allocate(32);
+            tu.expect(b6.ptr == b2.ptr && allocations == 3, "Step 8 block was not recycled");
+
+            tu.expect(allocator.expand(b6, 8) == error::allocation_failure, "Step 9 expanded across classes");
+
+            auto [owned, oe] = allocator.owns(b6);
+            tu.expect(owned == true, "Step 10 bucketizer does not own its block");
+
+            allocator.deallocate(b6);
+        }
+        tu.expect(allocations == deallocations, "Step 11 cached blocks leaked");
+    });
+
+    tu.test([&tu] () -> void {
+        using allocator_type = memory::thread_cache_allocator<counting_allocator, 64, 4>;
+        allocator_type allocator;
+
+        // The first allocation refills the magazine with a batch
+        auto [b1, e1] = allocator.allocate(20);
+        tu.expect(e1 == error::no_error && allocations == 4, "Step 1 magazine was not refilled");
+        tu.expect(allocator.cached() == 3, "Step 2 cached = 3");
+
+        // Instances share the magazines
+        allocator_type other;
+        auto [b2, e2] = other.allocate(32);
+        tu.expect(allocations == 4 && other.cached() == 2, "Step 3 magazines are not shared");
+
+        tu.expect(allocator.expand(b1, 12) == error::no_error, "Step 4 block did not expand to its class");
+        tu.expect(allocator.expand(b1, 1) == error::allocation_failure, "Step 5 block expanded past its class");
+
+        // Large requests go to the parent directly
+        auto [b3, e3] = allocator.allocate(100);
+        tu.expect(allocations == 5 && allocator.cached() == 2, "Step 6 large request was cached");
+        allocator.deallocate(b3);
+
+        allocator.deallocate(b1);
+        allocator.deallocate(b2);
+        allocator.flush();
+        tu.expect(allocator.cached() == 0 && allocations == deallocations, "Step 7 flush leaked blocks");
+    });
+
+    tu.test([&tu] () -> void {
+        using allocator_type = memory::thread_cache_allocator<counting_allocator, 128, 8>;
+
+        std::vector<std::thread> threads;
+        for (int t=0; t<4; t++) {
+            threads.push_back(std::thread([] () {
+                allocator_type allocator;
+                std::vector<memory::block> blocks;
+
+                for (int round=0; round<10; round++) {
+                    for (int i=0; i<100; i++) {
+                        auto [blk, err] = allocator.allocate(1 + (i*7) % 128);
+                        memset(blk.ptr, 0, blk.size);
+                        blocks.push_back(blk);
+                    }
+
+                    for (auto& blk : blocks)
+                        allocator.deallocate(blk);
+
+                    blocks.clear();
+                }
+            }));
+        }
+
+        for (auto& thread : threads)
+            thread.join();
+
+        // Magazines of exited threads are flushed to the parent
+        tu.expect(allocations > 0 && allocations == deallocations, "Step 1 thread caches leaked");
+    });
+
+    tu.test([&tu] () -> void {
+        using pool_type = memory::concurrent_pool<24, 4096>;
+        pool_type pool;
+
+        auto [b1, e1] = pool.allocate(24);
+        auto [b2, e2] = pool.allocate(8);
+        auto [b3, e3] = pool.allocate(64);
+        tu.expect(e1 == error::no_error && e2 == error::no_error, "Step 1 allocation failed");
+        tu.expect(e3 == error::allocation_failure, "Step 2 allocated past the block size");
+        tu.expect((size_t)b1.ptr % memory::default_alignment == 0, "Step 3 block is misaligned");
+
+        auto [owned, oe] = pool.owns(b1);
+        tu.expect(owned == true, "Step 4 pool does not own its block");
+
+        pool.deallocate(b2);
+        auto [b4, e4] = pool.allocate(16);
+        tu.expect(b4.ptr == b2.ptr, "Step 5 freed block was not reused");
+
+        // Spans more than one chunk
+        std::set<void*> blocks;
+        for (size_t i=0; i<3*pool_type::blocks_per_chunk; i++) {
+            auto [blk, err] = pool.allocate(24);
+            blocks.insert(blk.ptr);
+        }
+        tu.expect(blocks.size() == 3*pool_type::blocks_per_chunk, "Step 6 block was handed out twice");
+
+        for (auto ptr : blocks)
+            pool.deallocate({ptr, 24});
+
+#ifndef __SANITIZE_ADDRESS__
+        // A chunk that cannot be allocated does not use up its slot. The child
+        // runs out of address space, which the sanitizer does not survive.
+        pid_t pid = fork();
+        if (pid == 0) {
+            using single_type = memory::concurrent_pool<24, 64 << 20, 1>;
+            single_type single;
+
+            long pages = 0;
+            FILE *statm = fopen("/proc/self/statm", "r");
+            if (statm == nullptr || fscanf(statm, "%ld", &pages) != 1)
+                _exit(2);
+            fclose(statm);
+
+            struct rlimit limit;
+            getrlimit(RLIMIT_AS, &limit);
+
+            struct rlimit lowered = limit;
+            lowered.rlim_cur = pages * memory::page_size() + (16 << 20);
+            setrlimit(RLIMIT_AS, &lowered);
+
+            auto [failed, fe] = single.allocate(24);
+            setrlimit(RLIMIT_AS, &limit);
+
+            auto [retried, re] = single.allocate(24);
+            _exit(fe == error::allocation_failure && re == error::no_error ? 0 : 1);
+        }
+
+        int status = -1;
+        waitpid(pid, &status, 0);
+        tu.expect(WIFEXITED(status) && WEXITSTATUS(status) == 0, "Step 7 failed chunk used up its slot");
+#endif
+    });
+
+    tu.test([&tu] () -> void {
+        using pool_type = memory::concurrent_pool<32, 4096>;
+
+        std::mutex lock;
+        std::vector<memory::block> handoff;
+        std::vector<std::thread> threads;
+        std::atomic_bool corrupted(false);
+
+        // Producers allocate and tag the blocks, consumers on other threads
+        // verify and free them.
+        for (int t=0; t<4; t++) {
+            threads.push_back(std::thread([&lock, &handoff, t] () {
+                pool_type pool;
+                for (int i=0; i<5000; i++) {
+                    auto [blk, err] = pool.allocate(32);
+                    memset(blk.ptr, t + 1, blk.size);
+
+                    std::lock_guard<std::mutex> guard(lock);
+                    handoff.push_back(blk);
+                }
+            }));
+
+            threads.push_back(std::thread([&lock, &handoff, &corrupted] () {
+                pool_type pool;
+                for (int freed=0; freed<5000;) {
+                    memory::block blk{nullptr, 0};
+                    {
+                        std::lock_guard<std::mutex> guard(lock);
+                        if (handoff.empty() == false) {
+                            blk = handoff.back();
+                            handoff.pop_back();
+                        }
+                    }
+
+                    if (blk.ptr == nullptr) {
+                        std::this_thread::yield();
+                        continue;
+                    }
+
+                    char *bytes = (char*)blk.ptr;
+                    for (size_t i=1; i<blk.size; i++)
+                        if (bytes[i] != bytes[0])
+                            corrupted = true;
+
+                    pool.deallocate(blk);
+                    freed++;
+                }
+            }));
+        }
+
+        for (auto& thread : threads)
+            thread.join();
+
+        tu.expect(corrupted == false, "Step 1 block was shared between threads");
+
+        pool_type pool;
+        std::set<void*> blocks;
+        for (int i=0; i<20000; i++) {
+            auto [blk, err] = pool.allocate(32);
+            blocks.insert(blk.ptr);
+        }
+        tu.expect(blocks.size() == 20000, "Step 2 free list was corrupted");
+    });
+
+    tu.test([&tu] () -> void {
+        memory::mmap_allocator allocator;
+
+        auto [b1, e1] = allocator.allocate(10000);
+        tu.expect(e1 == error::no_error && b1.size == 10000, "Step 1 allocation failed");
+        tu.expect((size_t)b1.ptr % memory::page_size() == 0, "Step 2 block is not page aligned");
+        memset(b1.ptr, 0xcc, b1.size);
+
+        // Growth within the last page never moves
+        size_t slack = memory::align_up(10000, memory::page_size()) - 10000;
+        tu.expect(allocator.expand(b1, slack) == error::no_error, "Step 3 block did not expand in its page");
+
+        tu.expect(allocator.deallocate(b1) == error::no_error, "Step 4 deallocation failed");
+
+        // Huge pages fall back to regular pages when they are not available
+        memory::mmap_allocator huge(memory::huge_page_mode::Explicit);
+        auto [b2, e2] = huge.allocate(4096);
+        tu.expect(e2 == error::no_error, "Step 5 huge page allocation did not fall back");
+        memset(b2.ptr, 0, b2.size);
+        tu.expect(huge.deallocate(b2) == error::no_error, "Step 6 huge page deallocation failed");
+    });
+
+    tu.test([&tu] () -> void {
+        memory::region_allocator region(1ul << 30, memory::huge_page_mode::Explicit);
+        tu.expect(region.capacity() == 1ul << 30, "Step 1 reservation failed");
+
+        auto [b1, e1] = region.allocate(3 * memory::huge_page_size);
+        tu.expect(e1 == error::no_error, "Step 2 allocation failed");
+        memset(b1.ptr, 0x11, b1.size);
+
+        auto [b2, e2] = region.allocate(100);
+        tu.expect((char*)b2.ptr == (char*)b1.ptr + b1.size, "Step 3 blocks are not contiguous");
+        tu.expect(region.expand(b2, memory::huge_page_size) == error::no_error, "Step 4 top block did not expand");
+        memset(b2.ptr, 0x22, b2.size);
+
+        auto [owned, oe] = region.owns(b2);
+        tu.expect(owned == true, "Step 5 region does not own its block");
+
+        auto [b3, e3] = region.allocate(1ul << 30);
+        tu.expect(e3 == error::allocation_failure, "Step 6 allocated past the reservation");
+
+        region.deallocate_all();
+        auto [b4, e4] = region.allocate(16);
+        tu.expect(b4.ptr == b1.ptr, "Step 7 region was not reset");
+
+        memory::region_allocator plain(1ul << 20);
+        tu.expect(plain.get_mode() == memory::huge_page_mode::None, "Step 8 huge pages were not requested");
+    });
+
+    tu.test([&tu] () -> void {
+        memory::heap_allocator heap;
+        auto [b1, e1] = heap.allocate(100, 256);
+        tu.expect(e1 == error::no_error && is_aligned(b1.ptr, 256), "Step 1 heap block is misaligned");
+        heap.deallocate(b1);
+
+        auto [b2, e2] = heap.allocate(100, 48);
+        tu.expect(e2 == error::invalid_argument, "Step 2 accepted a non power of two alignment");
+
+        memory::arena_allocator arena(1024);
+        arena.allocate(8);
+        auto [b3, e3] = arena.allocate(8, 64);
+        auto [b4, e4] = arena.allocate(1000, 512);
+        tu.expect(is_aligned(b3.ptr, 64) && is_aligned(b4.ptr, 512), "Step 3 arena block is misaligned");
+
+        memory::stack_allocator<512> stack;
+        stack.allocate(8);
+        auto [b5, e5] = stack.allocate(8, 128);
+        tu.expect(e5 == error::no_error && is_aligned(b5.ptr, 128), "Step 4 stack block is misaligned");
+
+        memory::region_allocator region(1ul << 24);
+        region.allocate(8);
+        auto [b6, e6] = region.allocate(8, 4096);
+        tu.expect(e6 == error::no_error && is_aligned(b6.ptr, 4096), "Step 5 region block is misaligned");
+
+        memory::mmap_allocator mapper;
+        auto [b7, e7] = mapper.allocate(5000, 1ul << 21);
+        tu.expect(e7 == error::no_error && is_aligned(b7.ptr, 1ul << 21), "Step 6 mapped block is misaligned");
+        memset(b7.ptr, 0, b7.size);
+        mapper.deallocate(b7);
+
+        memory::fallback_allocator<memory::stack_allocator<64>, memory::heap_allocator> fallback;
+        auto [b8, e8] = fallback.allocate(32, 128);
+        tu.expect(e8 == error::no_error && is_aligned(b8.ptr, 128), "Step 7 fallback block is misaligned");
+        fallback.deallocate(b8);
+
+        memory::freelist<memory::heap_allocator, 16, 64, 4> list;
+        auto [b9, e9] = list.allocate(32, 64);
+        tu.expect(e9 == error::no_error && is_aligned(b9.ptr, 64), "Step 8 freelist block is misaligned");
+        list.deallocate(b9);
+    });
+
+    tu.test([&tu] () -> void {
+        auto [raw, err] = memory::make<cache_line>(7);
+        tu.expect(err == error::no_error && is_aligned(raw, 64), "Step 1 made object is misaligned");
+        tu.expect(raw->value == 7, "Step 2 made object was not constructed");
+        memory::destruct(raw);
+        free(raw);
+
+        for (int i=0; i<16; i++) {
+            auto obj = make_object<cache_line>(i);
+            tu.expect(is_aligned(&(*obj), 64), "Step 3 object is misaligned");
+
+            auto [ptr, perr] = obj.get_pointer();
+            tu.expect(ptr.is_valid() && ptr->value == i, "Step 4 pointer is not valid");
+        }
+
+        auto obj = make_object<long double>(1.0L);
+        tu.expect(is_aligned(&(*obj), alignof(long double)), "Step 5 long double is misaligned");
+    });
+
+    tu.test([&tu] () -> void {
+        memory::heap_allocator heap;
+
+        auto [blk, err] = heap.allocate(100);
+        memset(blk.ptr, 0x5a, blk.size);
+
+        // Grow far enough to force malloc to map the chunk and move it
+        for (size_t size : {200, 5000, 1 << 20, 64 << 20}) {
+            tu.expect(heap.expand(blk, size - blk.size) == error::no_error, "Step 1 heap block did not expand");
+            tu.expect(blk.size == size, "Step 2 expanded size mismatch");
+        }
+
+        bool preserved = true;
+        for (size_t i=0; i<100; i++)
+            preserved = preserved && ((unsigned char*)blk.ptr)[i] == 0x5a;
+        tu.expect(preserved, "Step 3 content was not preserved");
+        heap.deallocate(blk);
+
+        auto [aligned, aerr] = heap.allocate(64, 256);
+        for (int i=0; i<8; i++)
+            heap.expand(aligned, 4096 << i, 256);
+        tu.expect(is_aligned(aligned.ptr, 256), "Step 4 moved block lost its alignment");
+
+        memory::block before = aligned;
+        tu.expect(heap.expand(aligned, SIZE_MAX, 256) == error::allocation_failure, "Step 5 oversized expand succeeded");
+        tu.expect(aligned.ptr == before.ptr && aligned.size == before.size, "Step 6 failed expand changed the block");
+        heap.deallocate(aligned);
+
+        memory::block null_block{nullptr, 0};
+        tu.expect(heap.expand(null_block, 16) == error::null_pointer, "Step 7 expanded a null block");
+    });
+
+    tu.test([&tu] () -> void {
+        memory::mmap_allocator mapper;
+
+        auto [blk, err] = mapper.allocate(4096);
+        memset(blk.ptr, 0x3c, blk.size);
+
+        // Pin the page right after the block so it has to move
+        void *next = (char*)blk.ptr + 4096;
+        void *pin = mmap(next, 4096, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE, -1, 0);
+
+        void *old_ptr = blk.ptr;
+        tu.expect(mapper.expand(blk, 1 << 20) == error::no_error, "Step 1 mapped block did not expand");
+        tu.expect(pin != next || blk.ptr != old_ptr, "Step 2 block grew over a taken page");
+        tu.expect(((unsigned char*)blk.ptr)[4095] == 0x3c, "Step 3 content was not preserved");
+        memset(blk.ptr, 0, blk.size);
+        mapper.deallocate(blk);
+
+        if (pin != MAP_FAILED)
+            munmap(pin, 4096);
+
+        auto [huge, herr] = mapper.allocate(4096, 1ul << 21);
+        tu.expect(mapper.expand(huge, 64ul << 20, 1ul << 21) == error::no_error, "Step 4 aligned block did not expand");
+        tu.expect(is_aligned(huge.ptr, 1ul << 21), "Step 5 moved mapping lost its alignment");
+        mapper.deallocate(huge);
+    });
+
+    tu.test([&tu] () -> void {
+        using allocator_type = memory::affix_allocator<counting_allocator, uint32_t, uint64_t>;
+        allocator_type allocator;
+
+        auto [blk, err] = allocator.allocate(20);
+        tu.expect(err == error::no_error && is_aligned(blk.ptr, memory::default_alignment),
+                  "Step 1 affixed block is misaligned");
+
+        *allocator.prefix(blk) = 0xabcd;
+        *allocator.suffix(blk) = 0x1234567890;
+        memset(blk.ptr, 0xff, blk.size);
+        tu.expect(*allocator.prefix(blk) == 0xabcd, "Step 2 prefix was overwritten");
+        tu.expect(*allocator.suffix(blk) == 0x1234567890, "Step 3 suffix was overwritten");
+
+        // The suffix follows the end of the block
+        tu.expect(allocator.expand(blk, 1000) == error::no_error, "Step 4 affixed block did not expand");
+        tu.expect(*allocator.prefix(blk) == 0xabcd, "Step 5 prefix was lost");
+        tu.expect(*allocator.suffix(blk) == 0x1234567890, "Step 6 suffix was lost");
+        memset(blk.ptr, 0xff, blk.size);
+
+        tu.expect(allocator.deallocate(blk) == error::no_error, "Step 7 deallocation failed");
+        tu.expect(allocations == 1 && deallocations == 1, "Step 8 parent was not used");
+
+        // Over-aligned blocks need a parent that allocates aligned blocks
+        auto [bad, berr] = allocator.allocate(20, 256);
+        tu.expect(berr == error::allocation_failure, "Step 9 parent without alignment served an aligned block");
+
+        memory::affix_allocator<memory::heap_allocator, uint32_t, uint64_t> heap;
+        auto [aligned, aerr] = heap.allocate(20, 256);
+        tu.expect(aerr == error::no_error && is_aligned(aligned.ptr, 256), "Step 10 over-aligned block is misaligned");
+
+        *heap.prefix(aligned) = 0xabcd;
+        *heap.suffix(aligned) = 0x1234567890;
+        tu.expect(heap.expand(aligned, 1 << 20) == error::no_error && is_aligned(aligned.ptr, 256),
+                  "Step 11 moved over-aligned block lost its alignment");
+        tu.expect(*heap.prefix(aligned) == 0xabcd && *heap.suffix(aligned) == 0x1234567890,
+                  "Step 12 over-aligned block lost its affixes");
+        tu.expect(heap.deallocate(aligned) == error::no_error, "Step 13 over-aligned deallocation failed");
+    });
+
+    tu.test([&tu] () -> void {
+        using allocator_type = memory::stats_allocator<memory::heap_allocator>;
+        allocator_type allocator;
+
+        std::vector<memory::block> blocks;
+        for (int i=0; i<3; i++) {
+            auto [blk, err] = allocator.allocate(100);
+            blocks.push_back(blk);
+        }
+        auto [other, oerr] = allocator.allocate(5000);
+
+        auto snapshot = allocator_type::snapshot();
+        tu.expect(snapshot.total.allocations == 4, "Step 1 allocations = 4");
+        tu.expect(snapshot.total.live_bytes == 5300, "Step 2 live bytes = 5300");
+        tu.expect(snapshot.call_sites.size() == 2, "Step 3 call sites = 2");
+        tu.expect(snapshot.size_buckets[7].allocations == 3, "Step 4 bucket 7 allocations = 3");
+        tu.expect(snapshot.size_buckets[13].allocations == 1, "Step 5 bucket 13 allocations = 1");
+
+        allocator.expand(other, 100);
+        for (auto& blk : blocks)
+            allocator.deallocate(blk);
+
+        snapshot = allocator_type::snapshot();
+        tu.expect(snapshot.total.deallocations == 3, "Step 6 deallocations = 3");
+        tu.expect(snapshot.total.live_bytes == 5100, "Step 7 live bytes = 5100");
+        tu.expect(snapshot.total.peak_bytes == 5400, "Step 8 peak bytes = 5400");
+
+        // Frees are charged to the allocating call site
+        size_t freed_sites = 0;
+        for (auto& site : snapshot.call_sites) {
+            if (site.stats.allocations == 3 && site.stats.deallocations == 3 && site.stats.live_bytes == 0)
+                freed_sites++;
+            if (site.stats.allocations == 1 && site.stats.live_bytes == 5100)
+                freed_sites++;
+        }
+        tu.expect(freed_sites == 2, "Step 9 call site counters mismatch");
+
+        allocator.deallocate(other);
+    });
+
+    tu.test([&tu] () -> void {
+        memory::arena_allocator arena(4096);
+
+        {
+            std::vector<int, memory::std_allocator<int, memory::arena_allocator>> values(arena);
+            for (int i=0; i<1000; i++)
+                values.push_back(i);
+
+            auto [owned, err] = arena.owns({values.data(), sizeof(int)});
+            tu.expect(owned == true, "Step 1 vector does not draw from the arena");
+            tu.expect(values[999] == 999, "Step 2 vector content mismatch");
+
+            using map_allocator = memory::std_allocator<std::pair<const int, int>, memory::arena_allocator>;
+            std::map<int, int, std::less<int>, map_allocator> squares(arena);
+            for (int i=0; i<100; i++)
+                squares[i] = i*i;
+            tu.expect(squares.size() == 100 && squares[9] == 81, "Step 3 map content mismatch");
+            tu.expect(squares.get_allocator() == values.get_allocator(), "Step 4 rebound allocators differ");
+        }
+
+        std::vector<int, memory::std_allocator<int, counting_allocator>> counted;
+        counted.push_back(1);
+        tu.expect(allocations == 1, "Step 5 default adapter did not use A");
+    });
+
+    tu.test([&tu] () -> void {
+        memory::arena_allocator arena(4096);
+        memory::resource_adapter<memory::arena_allocator> resource(arena);
+
+        std::pmr::vector<std::pmr::string> names(&resource);
+        for (int i=0; i<100; i++)
+            names.emplace_back("a string that does not fit the small string buffer");
+
+        auto [owned, err] = arena.owns({(void*)names[50].data(), 1});
+        tu.expect(owned == true, "Step 1 string does not draw from the arena");
+
+        memory::resource_adapter<memory::arena_allocator> same(arena);
+        memory::arena_allocator other_arena;
+        memory::resource_adapter<memory::arena_allocator> other(other_arena);
+        tu.expect(resource.is_equal(same) && !resource.is_equal(other), "Step 2 resource equality mismatch");
+
+        void *aligned = resource.allocate(10, 256);
+        tu.expect(is_aligned(aligned, 256), "Step 3 resource ignored the alignment");
+    });
+
+    tu.test([&tu] () -> void {
+        memory::numa_allocator numa(1ul << 24);
+
+        tu.expect(numa.node_count() >= 1 && numa.node_count() <= memory::numa_allocator::system_node_count(),
+                  "Step 1 unexpected node count");
+        tu.expect(numa.is_bound() == (numa.node_count() > 1), "Step 2 single node should not be bound");
+        tu.expect(numa.local_node() < numa.node_count(), "Step 3 local node out of range");
+
+        auto [b1, e1] = numa.allocate(100);
+        tu.expect(e1 == error::no_error, "Step 4 allocation failed");
+        memset(b1.ptr, 0x11, b1.size);
+
+        auto [owned, oe] = numa.owns(b1);
+        tu.expect(owned == true, "Step 5 allocator does not own its block");
+
+        auto [b2, e2] = numa.allocate_on(numa.node_count() - 1, 64, 4096);
+        tu.expect(e2 == error::no_error && is_aligned(b2.ptr, 4096), "Step 6 node allocation failed");
+
+        auto [b3, e3] = numa.allocate_on(numa.node_count(), 64);
+        tu.expect(e3 == error::invalid_argument, "Step 7 allocated on an unknown node");
+
+        tu.expect(numa.deallocate(b2) == error::no_error, "Step 8 deallocation failed");
+        tu.expect(numa.deallocate({&tu, 8}) == error::invalid_address, "Step 9 freed a foreign block");
+
+        // Threads on any node allocate concurrently
+        std::vector<std::thread> workers;
+        std::atomic<int> failures(0);
+
+        for (int t = 0; t < 4; t++) {
+            workers.emplace_back([&numa, &failures] () {
+                for (int i = 0; i < 1000; i++) {
+                    auto [blk, err] = numa.allocate(32);
+                    if (err != error::no_error) {
+                        failures++;
+                        continue;
+                    }
+                    memset(blk.ptr, 0x22, blk.size);
+                }
+            });
+        }
+
+        for (auto& worker : workers)
+            worker.join();
+
+        tu.expect(failures == 0, "Step 10 concurrent allocations failed");
+
+        numa.deallocate_all();
+        auto [b4, e4] = numa.allocate_on(0, 16);
+        tu.expect(b4.ptr == b1.ptr || numa.local_node() != 0, "Step 11 allocator was not reset");
+    });
+
+    tu.test([&tu] () -> void {
+        struct expensive
+        {
+            int *buffer;
+            expensive(int value = 0) : buffer(new int[64]) { buffer[0] = value; allocations++; }
+            ~expensive() { delete[] buffer; deallocations++; }
+        };
+
+        allocations = deallocations = 0;
+
+        {
+            memory::slab<expensive, memory::heap_allocator, 2> cache;
+
+            auto [o1, e1] = cache.acquire(7);
+            auto [o2, e2] = cache.acquire(8);
+            auto [o3, e3] = cache.acquire(9);
+            tu.expect(e1 == error::no_error && e3 == error::no_error && allocations == 3, "Step 1 acquire failed");
+            tu.expect(is_aligned((char*)o1 - memory::slab<expensive>::object_offset, memory::slab<expensive>::slot_alignment),
+                      "Step 2 slot is misaligned");
+
+            cache.recycle(o2);
+            auto [o4, e4] = cache.acquire(10);
+            tu.expect(o4 == o2 && o4->buffer[0] == 8 && allocations == 3, "Step 3 cached object was constructed again");
+
+            cache.release(o3);
+            tu.expect(deallocations == 1, "Step 4 released object was not destroyed");
+
+            auto [o5, e5] = cache.acquire(11);
+            tu.expect(o5 == o3 && o5->buffer[0] == 11 && allocations == 4, "Step 5 released slot was not constructed");
+
+            auto [b1, be1] = cache.allocate(sizeof(expensive) + 8);
+            auto [owned, oe] = cache.owns(b1);
+            tu.expect(be1 == error::no_error && owned == true, "Step 6 raw slot allocation failed");
+            cache.deallocate(b1);
+
+            auto [b2, be2] = cache.allocate(memory::slab<expensive>::slot_size + 1);
+            tu.expect(be2 == error::allocation_failure, "Step 7 allocated past the slot size");
+
+            // Foreign, misplaced and oversized blocks leave the free list alone
+            char foreign[memory::slab<expensive>::slot_size];
+            auto [b3, be3] = cache.allocate(8);
+            tu.expect(cache.deallocate({foreign, 8}) == error::invalid_argument &&
+                      cache.deallocate({(char*)b3.ptr + 8, 8}) == error::invalid_argument &&
+                      cache.deallocate({b3.ptr, memory::slab<expensive>::slot_size + 1}) == error::invalid_argument &&
+                      cache.deallocate(b3) == error::no_error, "Step 8 invalid block was freed");
+
+            auto [b4, be4] = cache.allocate(8);
+            tu.expect(b4.ptr == b3.ptr, "Step 9 free list was corrupted");
+            cache.deallocate(b4);
+
+            cache.recycle(o1);
+            cache.recycle(o4);
+            cache.recycle(o5);
+            tu.expect(cache.cached() == 3, "Step 10 cached count mismatch");
+        }
+
+        tu.expect(allocations == deallocations, "Step 11 cached objects were not destroyed");
+    });
+
+    tu.test([&tu] () -> void {
+        using profiled = memory::sampling_allocator<memory::heap_allocator>;
+        profiled allocator;
+
+        auto read_file = [] (FILE *file) -> std::string {
+            std::string text;
+            char buffer[4096];
+            size_t length;
+
+            rewind(file);
+            while ((length = fread(buffer, 1, sizeof(buffer), file)) > 0)
+                text.append(buffer, length);
+
+            return text;
+        };
+
+        // Off by default, nothing is sampled
+        auto [b0, e0] = allocator.allocate(4096);
+        tu.expect(memory::heap_profiler::live_samples() == 0, "Step 1 sampled while off");
+
+        // With an interval of one byte every allocation is sampled
+        memory::heap_profiler::set_sample_interval(1);
+
+        auto [b1, e1] = allocator.allocate(100);
+        auto [b2, e2] = allocator.allocate(200, 16);
+        tu.expect(e2 == error::no_error && is_aligned(b2.ptr, 16), "Step 2 aligned allocation failed");
+        tu.expect(memory::heap_profiler::live_samples() == 2, "Step 3 allocations were not sampled");
+
+        FILE *folded = tmpfile();
+        tu.expect(memory::heap_profiler::dump(folded, memory::heap_profile_format::Folded) == error::no_error, "Step 4 dump failed");
+
+        std::string stacks = read_file(folded);
+        fclose(folded);
+        tu.expect(stacks.find(" 100\n") != std::string::npos && stacks.find(" 200\n") != std::string::npos,
+                  "Step 5 folded stacks miss a sample");
+        tu.expect(stacks.find(';') != std::string::npos, "Step 6 folded stacks have no frames");
+
+        allocator.deallocate(b1);
+        tu.expect(memory::heap_profiler::live_samples() == 1, "Step 7 freed sample was not dropped");
+
+        FILE *pprof = tmpfile();
+        memory::heap_profiler::dump(pprof, memory::heap_profile_format::Pprof);
+
+        std::string profile = read_file(pprof);
+        fclose(pprof);
+        tu.expect(profile.rfind("heap profile: 1: 200 [1: 200] @ heap_v2/1\n", 0) == 0, "Step 8 pprof header mismatch");
+        tu.expect(profile.find("MAPPED_LIBRARIES:") != std::string::npos, "Step 9 pprof mappings are missing");
+
+        // A signal requests a dump, written by the next poll and never by an
+        // allocation
+        char path[] = "/tmp/ltd-heap-XXXXXX";
+        int fd = mkstemp(path);
+        close(fd);
+
+        memory::heap_profiler::dump_on_signal(SIGUSR2, path, memory::heap_profile_format::Folded);
+        raise(SIGUSR2);
+
+        auto [b3, e3] = allocator.allocate(300);
+        struct stat status;
+        tu.expect(stat(path, &status) == 0 && status.st_size == 0, "Step 10 sampled allocation wrote the dump");
+        allocator.deallocate(b3);
+
+        memory::heap_profiler::poll();
+
+        FILE *requested = fopen(path, "r");
+        std::string dumped = requested != nullptr ? read_file(requested) : std::string();
+        if (requested != nullptr)
+            fclose(requested);
+        unlink(path);
+        tu.expect(dumped.find(" 200\n") != std::string::npos, "Step 11 signal did not dump the profile");
+
+        memory::heap_profiler::set_sample_interval(0);
+        allocator.deallocate(b2);
+        allocator.deallocate(b0);
+        tu.expect(memory::heap_profiler::live_samples() == 0, "Step 12 samples are left");
+    });
+
+    tu.test([&tu] () -> void {
+        char path[] = "/tmp/ltd-trace-XXXXXX";
+        int fd = mkstemp(path);
+        close(fd);
+
+        {
+            memory::allocation_trace trace(path);
+            tu.expect(trace.is_open(), "Step 1 trace was not created");
+
+            memory::recording_allocator<memory::heap_allocator> allocator(trace);
+
+            auto [b1, e1] = allocator.allocate(100);
+            auto [b2, e2] = allocator.allocate(64, 64);
+            allocator.expand(b1, 50);
+            allocator.deallocate(b2);
+
+            std::thread worker([&allocator] () {
+                auto [b3, e3] = allocator.allocate(24);
+                allocator.deallocate(b3);
+            });
+            worker.join();
+
+            allocator.deallocate(b1);
+        }
+
+        auto [records, err] = memory::allocation_trace::load(path);
+        unlink(path);
+
+        tu.expect(err == error::no_error && records.size() == 7, "Step 2 trace has the wrong number of records");
+        if (records.size() != 7)
+            return;
+
+        tu.expect(records[0].operation == (uint8_t)memory::trace_operation::Allocate && records[0].size == 100,
+                  "Step 3 first record is not the allocation");
+        tu.expect(records[1].alignment_log2 == 6, "Step 4 alignment was not recorded");
+        tu.expect(records[2].operation == (uint8_t)memory::trace_operation::Expand && records[2].size == 150,
+                  "Step 5 expansion was not recorded");
+        tu.expect(records[4].thread != records[0].thread, "Step 6 threads are not told apart");
+        tu.expect(records[6].timestamp >= records[0].timestamp, "Step 7 timestamps go backwards");
+
+        memory::heap_allocator heap;
+        auto result = memory::replay(records, heap);
+
+        tu.expect(result.operations == 7 && result.failures == 0, "Step 8 replay failed");
+        tu.expect(result.peak_bytes >= 150 + 64, "Step 9 peak of live bytes is too low");
+
+        // The freelist cannot expand its blocks past 128 bytes
+        memory::freelist<memory::heap_allocator, 0, 128, 8> candidate;
+        auto cached = memory::replay(records, candidate);
+        tu.expect(cached.operations == 7 && cached.failures == 1, "Step 10 expansion past the freelist blocks did not fail");
+
+        auto [missing, merr] = memory::allocation_trace::load("/nonexistent/trace");
+        tu.expect(merr == error::invalid_argument, "Step 11 loaded a missing trace");
+    });
+
+    tu.test([&tu] () -> void {
+        struct node
+        {
+            int                      value;
+            memory::offset_ptr<node> next;
+        };
+
+        char path[] = "/tmp/ltd-heap-XXXXXX";
+        int fd = mkstemp(path);
+        close(fd);
+        unlink(path);
+
+        {
+            memory::persistent_allocator heap(path, 64 * 1024);
+            tu.expect(heap.is_open() && heap.is_new(), "Step 1 heap was not created");
+
+            memory::persistent_allocator again(path);
+            tu.expect(again.is_open() == false, "Step 2 heap was opened twice");
+
+            // Build a list long enough to make the file grow, in place
+            node *head  = nullptr;
+            node *first = nullptr;
+            size_t first_capacity = heap.capacity();
+
+            for (int i = 0; i < 5000; i++) {
+                auto [blk, err] = heap.allocate(sizeof(node), alignof(node));
+                if (err != error::no_error)
+                    break;
+
+                node *n = (node*)blk.ptr;
+                memory::construct(n, node{i, head});
+
+                if (first == nullptr)
+                    first = n;
+
+                head = n;
+            }
+
+            tu.expect(heap.capacity() > first_capacity && first->value == 0 && heap.offset_of(first) == memory::page_size(),
+                      "Step 3 heap did not grow in place");
+            tu.expect(heap.set_root(head) == error::no_error, "Step 4 root was not set");
+            tu.expect(heap.set_root(&tu) == error::invalid_address, "Step 5 foreign root was accepted");
+            tu.expect(heap.sync() == error::no_error, "Step 6 sync failed");
+        }
+
+        {
+            memory::persistent_allocator heap(path);
+            tu.expect(heap.is_open() && heap.is_new() == false, "Step 7 heap was not opened again");
+
+            int expected = 4999;
+            bool intact  = true;
+
+            for (node *n = (node*)heap.get_root(); n != nullptr; n = n->next.get())
+                intact = intact && n->value == expected--;
+
+            tu.expect(intact && expected == -1, "Step 8 list did not survive the restart");
+
+            // Freed blocks are reused by the same size class
+            node *head = (node*)heap.get_root();
+            heap.set_root(head->next.get());
+            heap.deallocate({head, sizeof(node)});
+
+            auto [blk, err] = heap.allocate(sizeof(node));
+            tu.expect(blk.ptr == head, "Step 9 freed block was not reused");
+
+            auto [big, berr] = heap.allocate(3000, 4096);
+            tu.expect(berr == error::no_error && is_aligned(big.ptr, 4096), "Step 10 page aligned block failed");
+
+            auto [huge, herr] = heap.allocate(SIZE_MAX);
+            tu.expect(herr == error::allocation_failure && huge.ptr == nullptr, "Step 11 oversized block was accepted");
+            tu.expect(heap.expand(blk, SIZE_MAX) == error::allocation_failure, "Step 12 oversized expand was accepted");
+        }
+
+        // A crash while growing leaves the header ahead of the file, or the
+        // file ahead of the header
+        size_t capacity = 0;
+        {
+            memory::persistent_allocator heap(path);
+            capacity = heap.capacity();
+        }
+
+        uint64_t grown = capacity * 2;
+        fd = open(path, O_RDWR);
+        bool crashed = pwrite(fd, &grown, sizeof(grown), 8) == sizeof(grown);
+        close(fd);
+
+        {
+            memory::persistent_allocator heap(path);
+            tu.expect(crashed && heap.is_open() && heap.is_new() == false && heap.capacity() == grown &&
+                      ((node*)heap.get_root())->value == 4998, "Step 13 heap ahead of the file was not opened");
+        }
+
+        crashed = truncate(path, grown * 2) == 0;
+
+        {
+            memory::persistent_allocator heap(path);
+            tu.expect(crashed && heap.is_open() && heap.is_new() == false && heap.capacity() == grown,
+                      "Step 14 file ahead of the heap was not opened");
+        }
+
+        // A crash while creating leaves a file shorter than the header
+        crashed = truncate(path, 16) == 0;
+
+        {
+            memory::persistent_allocator heap(path);
+            tu.expect(crashed && heap.is_open() && heap.is_new() && heap.get_root() == nullptr,
+                      "Step 15 half created heap was not created again");
+        }
+
+        unlink(path);
+
+        memory::offset_ptr<int> empty;
+        int values[2] = {1, 2};
+        memory::offset_ptr<int> ptr(&values[1]);
+        memory::offset_ptr<int> copy = ptr;
+
+        tu.expect(!empty && empty.get() == nullptr, "Step 16 default offset_ptr is not null");
+        tu.expect(copy == ptr && *copy == 2, "Step 17 copied offset_ptr points elsewhere");
+    });
+
+    tu.test([&tu] () -> void {
+#ifdef LTD_MALLOC_PATH
+        // Child processes run with every allocation served by libltd_malloc.so
+        auto run = [] (const char *command) -> std::string {
+            std::string line = std::string("LD_PRELOAD=") + LTD_MALLOC_PATH + " " + command;
+            std::string output;
+
+            FILE *child = popen(line.c_str(), "r");
+            if (child == nullptr)
+                return output;
+
+            char buffer[256];
+            while (fgets(buffer, sizeof(buffer), child) != nullptr)
+                output += buffer;
+
+            if (pclose(child) != 0)
+                output += "failed";
+
+            return output;
+        };
+
+        tu.expect(run("/bin/sh -c 'seq 1 100000 | sort -rn | head -n 1'") == "100000\n", "Step 1 preloaded pipeline failed");
+        tu.expect(run("/bin/sh -c 'x=; for i in $(seq 1 2000); do x=\"$x$i\"; done; echo ${#x}'") == "6893\n",
+                  "Step 2 preloaded shell failed to grow a string");
+
+        char self[4096];
+        ssize_t length = readlink("/proc/self/exe", self, sizeof(self) - 1);
+        self[length > 0 ? length : 0] = 0;
+
+        std::string expected = std::to_string(ENOMEM) + " " + std::to_string(ENOMEM) + " " + std::to_string(ENOMEM) + " " +
+                               std::to_string(EINVAL) + " " + std::to_string(EINVAL) + "\n";
+        tu.expect(run((std::string("LTD_MALLOC_FAILURES=1 ") + self).c_str()) == expected,
+                  "Step 3 preloaded failures did not set errno");
+        tu.expect(run((std::string("LTD_MALLOC_FORKS=1 ") + self).c_str()) == "50\n",
+                  "Step 4 preloaded children of a multithreaded process could not allocate");
+        tu.expect(run((std::string("LTD_MALLOC_RELEASES=1 ") + self).c_str()) == "1 1\n",
+                  "Step 5 preloaded heap did not give freed memory back");
+#endif
+    });
+
+    tu.test([&tu] () -> void {
+        memory::region_allocator region(8ul << 20);
+        memory::purge_registration registration(region);
+
+        auto [blk, err] = region.allocate(4ul << 20);
+        memset(blk.ptr, 1, blk.size);
+        region.deallocate_all();
+
+        tu.expect(region.purge() == 4ul << 20, "Step 1 region did not purge its committed pages");
+        tu.expect(memory::purge() == 4ul << 20, "Step 2 registered region was not purged");
+
+        std::tie(blk, err) = region.allocate(1ul << 20);
+        memset(blk.ptr, 2, blk.size);
+        tu.expect(err == error::no_error && ((char*)blk.ptr)[4095] == 2, "Step 3 purged region is not usable");
+        tu.expect(region.purge() == 3ul << 20, "Step 4 region purged pages in use");
+
+        memory::arena_allocator arena(1ul << 20);
+        std::tie(blk, err) = arena.allocate(512ul << 10);
+        memset(blk.ptr, 3, blk.size);
+
+        tu.expect(arena.purge() >= (512ul << 10) - memory::page_size(), "Step 5 arena did not purge its free tail");
+        tu.expect(((char*)blk.ptr)[blk.size - 1] == 3, "Step 6 arena purged a block in use");
+
+        memory::freelist<memory::heap_allocator, 8192, 16384, 16> list;
+        void *ptrs[4];
+
+        for (auto& ptr : ptrs) {
+            std::tie(blk, err) = list.allocate(16384);
+            memset(blk.ptr, 4, blk.size);
+            ptr = blk.ptr;
+        }
+
+        for (auto ptr : ptrs)
+            list.deallocate({ptr, 16384});
+
+        size_t purged = list.purge();
+        tu.expect(purged >= 4 * (16384 - 2 * memory::page_size()) && list.cached() == 4,
+                  "Step 7 freelist did not purge its cached blocks");
+
+        std::tie(blk, err) = list.allocate(16384);
+        memset(blk.ptr, 5, blk.size);
+        tu.expect(((char*)blk.ptr)[8191] == 5, "Step 8 purged block is not usable");
+        list.deallocate(blk);
+
+        memory::set_purge_decay(std::chrono::milliseconds(0));
+        memory::decay_clock clock;
+        usleep(2000);
+        tu.expect(clock.elapsed() == false, "Step 9 decay elapsed while disabled");
+
+        memory::set_purge_decay(std::chrono::milliseconds(1));
+        usleep(2000);
+        tu.expect(clock.elapsed() && clock.elapsed() == false, "Step 10 decay period did not restart");
+
+        memory::set_purge_decay(std::chrono::seconds(10));
+    });
+
+    tu.test([&tu] () -> void {
+        memory::block blocks[8];
+
+        memory::arena_allocator arena(4096);
+        auto [count, err] = memory::allocate_batch(arena, 40, 8, blocks);
+        tu.expect(count == 8 && err == error::no_error && blocks[7].size == 40 &&
+                  (char*)blocks[7].ptr == (char*)blocks[0].ptr + 7 * 48, "Step 1 arena batch is not contiguous");
+
+        memory::region_allocator region(1ul << 20);
+        std::tie(count, err) = memory::allocate_batch(region, 100, 8, blocks);
+        tu.expect(count == 8 && (char*)blocks[1].ptr == (char*)blocks[0].ptr + 112, "Step 2 region batch failed");
+
+        std::tie(count, err) = memory::allocate_batch(region, 1ul << 20, 8, blocks);
+        tu.expect(count == 0 && err == error::allocation_failure, "Step 3 region batch overflowed");
+
+        allocations = deallocations = 0;
+        {
+            memory::freelist<counting_allocator, 16, 64, 4> list;
+
+            auto [b1, e1] = list.allocate(32);
+            auto [b2, e2] = list.allocate(32);
+            list.deallocate(b1);
+            list.deallocate(b2);
+
+            std::tie(count, err) = memory::allocate_batch(list, 32, 8, blocks);
+            tu.expect(count == 8 && allocations == 8 && list.cached() == 0, "Step 4 freelist batch did not reuse its cache");
+            tu.expect(blocks[0].ptr == b2.ptr && blocks[1].ptr == b1.ptr && blocks[7].size == 32,
+                      "Step 5 freelist batch handed out the wrong blocks");
+
+            tu.expect(memory::deallocate_batch(list, blocks, 8) == error::no_error, "Step 6 freelist batch release failed");
+            tu.expect(list.cached() == 4 && deallocations == 4, "Step 7 freelist batch overfilled its cache");
+        }
+
+        memory::heap_allocator heap;
+        std::tie(count, err) = memory::allocate_batch(heap, 24, 8, blocks);
+        tu.expect(count == 8 && memory::deallocate_batch(heap, blocks, 8) == error::no_error,
+                  "Step 8 batch fallback of the heap failed");
+
+        memory::thread_cache_allocator<memory::heap_allocator, 64, 4> cache;
+        std::tie(count, err) = memory::allocate_batch(cache, 48, 8, blocks);
+        std::set<void*> distinct;
+        for (auto& blk : blocks)
+            distinct.insert(blk.ptr);
+
+        tu.expect(count == 8 && distinct.size() == 8 && cache.cached() == 0, "Step 9 thread cache batch failed");
+        tu.expect(memory::deallocate_batch(cache, blocks, 8) == error::no_error && cache.cached() == 4,
+                  "Step 10 thread cache did not flush the batch");
+        cache.flush();
+
+        memory::bucketizer<counting_pool, 0, 64, 16> buckets;
+        std::tie(count, err) = memory::allocate_batch(buckets, 20, 4, blocks);
+        auto [more, more_err] = memory::allocate_batch(buckets, 50, 4, blocks + 4);
+        tu.expect(count == 4 && more == 4, "Step 11 bucketizer batch failed");
+
+        tu.expect(memory::deallocate_batch(buckets, blocks, 8) == error::no_error &&
+                  buckets.get_bucket<1>().cached() == 4 && buckets.get_bucket<3>().cached() == 4,
+                  "Step 12 bucketizer batch went to the wrong size classes");
+    });
+
+    tu.test([&tu] () -> void {
+        static_assert(is_trivially_relocatable<int> && !is_trivially_relocatable<tracked>,
+                      "Only trivially copyable types are relocatable by default");
+
+        memory::heap_allocator heap;
+        memory::block buffer{nullptr, 0};
+
+        tu.expect(memory::relocate<int>(heap, buffer, 0, 4) == error::no_error && buffer.size == 4 * sizeof(int),
+                  "Step 1 empty buffer was not allocated");
+
+        for (int i=0; i<4; i++)
+            ((int*)buffer.ptr)[i] = i;
+
+        tu.expect(memory::relocate<int>(heap, buffer, 4, 1 << 16) == error::no_error && buffer.size == sizeof(int) << 16,
+                  "Step 2 buffer did not grow");
+        tu.expect(((int*)buffer.ptr)[3] == 3, "Step 3 grown buffer lost its content");
+        tu.expect(memory::relocate<int>(heap, buffer, 8, 4) == error::invalid_argument, "Step 4 buffer shrank its objects");
+        heap.deallocate(buffer);
+
+        memory::arena_allocator arena(4096);
+        buffer = {nullptr, 0};
+        memory::relocate<tracked>(arena, buffer, 0, 2);
+
+        for (int i=0; i<2; i++)
+            new ((tracked*)buffer.ptr + i) tracked(i + 1);
+
+        void *previous = buffer.ptr;
+        tu.expect(memory::relocate<tracked>(arena, buffer, 2, 64) == error::no_error && buffer.ptr != previous,
+                  "Step 5 buffer was expanded without moving its objects");
+        tu.expect(moves == 2 && destroyed == 2 && ((tracked*)buffer.ptr)[1].value == 2,
+                  "Step 6 objects were not relocated one by one");
+    });
+
+    tu.test([&tu] () -> void {
+        char directory[] = "/tmp/ltd-cgroup-XXXXXX";
+        tu.expect(mkdtemp(directory) != nullptr, "Step 1 cgroup directory was not created");
+
+        std::string events   = std::string(directory) + "/memory.events";
+        std::string pressure = std::string(directory) + "/memory.pressure";
+
+        auto write = [] (const std::string& path, const char *content) {
+            FILE *file = fopen(path.c_str(), "w");
+            fputs(content, file);
+            fclose(file);
+        };
+
+        write(events, "low 0\nhigh 0\nmax 0\noom 0\noom_kill 0\n");
+        write(pressure, "some avg10=0.00 avg60=0.00 avg300=0.00 total=0\nfull avg10=0.00 avg60=0.00 avg300=0.00 total=0\n");
+
+        memory::pressure_monitor monitor(directory);
+        tu.expect(monitor.has_cgroup() && monitor.under_pressure() == false, "Step 2 idle cgroup is under pressure");
+
+        write(events, "low 0\nhigh 3\nmax 0\noom 0\noom_kill 0\n");
+        tu.expect(monitor.under_pressure() && monitor.under_pressure() == false, "Step 3 memory.events were not followed");
+
+        write(pressure, "some avg10=25.00 avg60=5.00 avg300=1.00 total=100\n");
+        tu.expect(monitor.under_pressure(), "Step 4 memory.pressure was ignored");
+
+        monitor.set_pressure_threshold(0);
+        tu.expect(monitor.under_pressure() == false, "Step 5 disabled PSI raised the pressure");
+
+        memory::freelist<memory::heap_allocator, 16, 64, 16> list;
+        memory::slab<int, memory::heap_allocator, 4> ints;
+        memory::pressure_registration slab_registration(monitor, ints);
+
+        memory::block blocks[4];
+        int *values[5];
+
+        {
+            // The freelist is not thread safe, it is only shrunk by poll()
+            memory::pressure_registration list_registration(monitor, list);
+
+            memory::allocate_batch(list, 64, 4, blocks);
+            memory::deallocate_batch(list, blocks, 4);
+
+            for (auto& value : values)
+                std::tie(value, std::ignore) = ints.acquire(1);
+            for (auto value : values)
+                ints.recycle(value);
+
+            tu.expect(monitor.poll() == 0 && list.cached() == 4 && ints.cached() == 5, "Step 6 allocators shrank without pressure");
+
+            monitor.set_rss_budget(1);
+            tu.expect(memory::pressure_monitor::resident_size() > 0 && monitor.poll() > 4 * 64,
+                      "Step 7 allocators did not shrink over the budget");
+            tu.expect(list.cached() == 0 && ints.cached() == 0, "Step 8 caches were not emptied");
+
+            auto [value, err] = ints.acquire(7);
+            tu.expect(err == error::no_error && *value == 7, "Step 9 shrunk slab is not usable");
+            ints.release(value);
+        }
+
+        for (auto& value : values)
+            std::tie(value, std::ignore) = ints.acquire(1);
+        for (auto value : values)
+            ints.recycle(value);
+
+        tu.expect(monitor.start(std::chrono::milliseconds(1)) == error::no_error, "Step 10 monitor did not start");
+        tu.expect(monitor.start(std::chrono::milliseconds(1)) == error::invalid_operation, "Step 11 monitor started twice");
+
+        // Wait for the background thread to empty the slab, for 10 seconds at most
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+        while (ints.cached() != 0 && std::chrono::steady_clock::now() < deadline)
+            std::this_thread::yield();
+
+        monitor.stop();
+        tu.expect(ints.cached() == 0, "Step 12 background thread did not shrink the slab");
+
+        unlink(events.c_str());
+        unlink(pressure.c_str());
+        rmdir(directory);
+    });
+
+    tu.run(argc, argv);
+
+    return 0;
+}
@@ -1,5 +1,8 @@
 #include <iostream>
+#include <optional>
 #include <string.h>
+#include <thread>
+#include <vector>
 #include <ltd.h>
 
 using namespace ltd;
@@ -19,6 +22,24 @@ public:
     }
 };
 
+int constructions = 0;
+int recycles = 0;
+
+class session
+{
+public:
+    std::vector<char> buffer;
+
+    session() : buffer(4096) {
+        constructions++;
+    }
+
+    void recycle() {
+        recycles++;
+        buffer.assign(buffer.size(), 0);
+    }
+};
+
 namespace ltd
 {
     namespace memory
@@ -102,6 +123,232 @@ auto main(int argc, char** argv) -> int
         tu.expect(counter == 0, "Step 2 counter = 0");        
     });
     
+    tu.test([&tu] () -> void {
+        memory::arena_allocator arena;
+        void *first = nullptr;
+        {
+            pointer<test_class, default_dltr<test_class>, memory::arena_allocator> ptr;
+            {
+                auto obj = make_object<test_class>(std::allocator_arg, arena);
+                tu.expect(counter == 1, "Step 1 counter = 1");
+
+                auto [owned, oerr] = arena.owns({(void*)&(*obj), sizeof(test_class)});
+                tu.expect(owned == true, "Step 2 object was not allocated from the arena");
+
+                auto [p, err] = obj.get_pointer();
+                ptr = p;
+                first = (void*)&(*ptr);
+            }
+            tu.expect(counter == 1, "Step 3 counter = 1");
+            tu.expect(ptr.is_valid() == false, "Step 4 pointer outlived its object");
+            tu.expect(counter == 0, "Step 5 counter = 0");
+        }
+
+        // The block went back to the arena, so the next one takes its place
+        auto obj = make_object<test_class>(std::allocator_arg, arena);
+        tu.expect((void*)&(*obj) == first, "Step 6 block was not released to the arena");
+    });
+
+    tu.test([&tu] () -> void {
+        using stateless_ptr = pointer<test_class, default_dltr<test_class>, memory::heap_allocator>;
+        using stateful_ptr  = pointer<test_class, default_dltr<test_class>, memory::arena_allocator>;
+
+        tu.expect(sizeof(stateless_ptr) == 2*sizeof(void*), "Step 1 stateless allocator takes space");
+        tu.expect(sizeof(stateful_ptr) == 3*sizeof(void*), "Step 2 stateful allocator is not referenced");
+
+        {
+            object<test_class> obj(new test_class());
+            auto [ptr, err] = obj.get_pointer();
+            tu.expect(err == error::no_error && ptr.is_valid(), "Step 3 wrapped pointer is not valid");
+        }
+        tu.expect(counter == 0, "Step 4 counter = 0");
+    });
+
+    tu.test([&tu] () -> void {
+        memory::arena_allocator outer;
+        memory::arena_allocator inner;
+        void *first = nullptr;
+
+        tu.expect(memory::allocator_scope::current() == nullptr, "Step 1 a scope is active");
+
+        {
+            memory::allocator_scope outer_scope(outer);
+
+            auto obj = make_object<test_class>();
+            first = (void*)&(*obj);
+
+            auto [owned, oerr] = outer.owns({first, sizeof(test_class)});
+            tu.expect(owned == true, "Step 2 object was not allocated from the scope");
+
+            {
+                memory::allocator_scope inner_scope(inner);
+
+                auto [value, err] = memory::make<int>(7);
+                auto [in_inner, ierr] = inner.owns({value, sizeof(int)});
+                tu.expect(in_inner == true && *value == 7, "Step 3 make() ignored the nested scope");
+            }
+
+            auto [value, err] = memory::make<int>(8);
+            auto [in_outer, ierr] = outer.owns({value, sizeof(int)});
+            tu.expect(in_outer == true, "Step 4 nested scope did not restore the outer scope");
+        }
+
+        tu.expect(memory::allocator_scope::current() == nullptr, "Step 5 scope was not restored");
+        tu.expect(counter == 0, "Step 6 counter = 0");
+
+        // An object that outlives its scope still goes back to the arena of the scope
+        memory::arena_allocator arena;
+        {
+            std::optional<memory::allocator_scope> scope;
+            scope.emplace(arena);
+
+            auto obj = make_object<test_class>();
+            first = (void*)&(*obj);
+
+            scope.reset();
+            tu.expect(counter == 1, "Step 7 counter = 1");
+        }
+        tu.expect(counter == 0, "Step 8 counter = 0");
+
+        memory::allocator_scope scope(arena);
+        auto obj = make_object<test_class>();
+        tu.expect((void*)&(*obj) == first, "Step 9 block was not released to the scope allocator");
+    });
+
+    tu.test([&tu] () -> void {
+        memory::slab<session, memory::heap_allocator, 4> sessions;
+        void *first = nullptr;
+
+        {
+            auto obj = make_object<session>(std::allocator_arg, sessions);
+            tu.expect(obj.is_null() == false && constructions == 1, "Step 1 session was not constructed");
+
+            obj->buffer[0] = 'x';
+            first = (void*)&(*obj);
+        }
+        tu.expect(recycles == 1 && sessions.cached() == 1, "Step 2 session was not recycled");
+
+        {
+            auto obj = make_object<session>(std::allocator_arg, sessions);
+            tu.expect((void*)&(*obj) == first, "Step 3 cached session was not reused");
+            tu.expect(constructions == 1 && obj->buffer[0] == 0, "Step 4 cached session was constructed again");
+            tu.expect(sessions.cached() == 0, "Step 5 cache was not emptied");
+
+            auto [ptr, err] = obj.get_pointer();
+            tu.expect(ptr.is_valid(), "Step 6 pointer to a cached session is not valid");
+        }
+        tu.expect(sessions.cached() == 1, "Step 7 session was not recycled again");
+
+        // A deleter without the recycle hook destroys the object
+        {
+            auto obj = make_object<test_class>(std::allocator_arg, sessions);
+            tu.expect(counter == 1, "Step 8 counter = 1");
+        }
+        tu.expect(counter == 0, "Step 9 counter = 0");
+
+        tu.expect(sessions.reclaim() == 1 && sessions.cached() == 0, "Step 10 cache was not reclaimed");
+    });
+
+    tu.test([&tu] () -> void {
+        static_assert(is_trivially_relocatable<pointer<test_class>>, "pointer<T> must be trivially relocatable");
+
+        memory::heap_allocator heap;
+        memory::block buffer{nullptr, 0};
+
+        {
+            auto obj = make_object<test_class>();
+            tu.expect(memory::relocate<pointer<test_class>>(heap, buffer, 0, 2) == error::no_error,
+                      "Step 1 buffer allocation failed");
+
+            pointer<test_class> *ptrs = (pointer<test_class>*)buffer.ptr;
+            for (int i=0; i<2; i++) {
+                auto [ptr, err] = obj.get_pointer();
+                new (ptrs + i) pointer<test_class>(ptr);
+            }
+
+            tu.expect(memory::relocate<pointer<test_class>>(heap, buffer, 2, 4096) == error::no_error,
+                      "Step 2 buffer did not grow");
+
+            ptrs = (pointer<test_class>*)buffer.ptr;
+            tu.expect(ptrs[0].is_valid() && ptrs[1].is_valid() && counter == 1, "Step 3 relocated pointers are not valid");
+
+            for (int i=0; i<2; i++)
+                ptrs[i].~pointer();
+        }
+        tu.expect(counter == 0, "Step 4 relocated pointers leaked their object");
+
+        heap.deallocate(buffer);
+    });
+
+    tu.test([&tu] () -> void {
+        using local_object = object<test_class, default_dltr<test_class>, memory::heap_allocator, plain_counter_policy>;
+        static_assert(std::is_same<local_object::counter_type, basic_ref_counter<plain_counter_policy>>::value &&
+                      std::is_same<local_object::pointer_type::counter_type, local_object::counter_type>::value,
+                      "The counter policy must reach the pointers");
+
+        {
+            auto obj = make_object<test_class, default_dltr<test_class>, memory::heap_allocator, plain_counter_policy>();
+            tu.expect(counter == 1, "Step 1 counter = 1");
+
+            auto [ptr, err] = obj.get_pointer();
+            auto copy = ptr;
+            tu.expect(copy.is_valid() && ptr.is_valid(), "Step 2 copied pointer is not valid");
+
+            // The object goes first, its pointers keep the memory alive
+            {
+                local_object moved(std::move(obj));
+            }
+            tu.expect(copy.is_valid() == false, "Step 3 pointer outlived its object");
+        }
+        tu.expect(counter == 0, "Step 4 last pointer did not destroy the object");
+
+        memory::arena_allocator arena;
+        {
+            auto obj = make_object<test_class, default_dltr<test_class>, memory::arena_allocator, plain_counter_policy>(std::allocator_arg, arena);
+            auto [ptr, err] = obj.get_pointer();
+
+            for (int i=0; i<1000; i++) {
+                auto copy = ptr;
+                tu.expect(copy.is_valid(), "Step 5 copy in a loop is not valid");
+            }
+        }
+        tu.expect(counter == 0, "Step 6 arena object was not destroyed");
+    });
+
+    tu.test([&tu] () -> void {
+        using arena_object = object<int, default_dltr<int>, memory::arena_allocator>;
+        static_assert(memory::is_thread_safe_allocator<memory::heap_allocator> &&
+                      memory::is_thread_safe_allocator<memory::arena_allocator> == false,
+                      "Only stateless and thread safe allocators are shared by every thread");
+
+        // Arenas are not thread safe, each thread makes its objects from its own
+        memory::arena_allocator *instances[2] = {nullptr, nullptr};
+        bool intact[2] = {false, false};
+        std::vector<std::thread> threads;
+
+        for (int t=0; t<2; t++) {
+            threads.emplace_back([&instances, &intact, t] () {
+                instances[t] = &memory::shared_allocator<memory::arena_allocator>();
+
+                std::vector<arena_object> objects;
+                for (int i=0; i<10000; i++)
+                    objects.push_back(make_object<int, default_dltr<int>, memory::arena_allocator>(t * 100000 + i));
+
+                bool same = true;
+                for (int i=0; i<10000; i++)
+                    same = same && *objects[i] == t * 100000 + i;
+
+                intact[t] = same;
+            });
+        }
+
+        for (auto& thread : threads)
+            thread.join();
+
+        tu.expect(instances[0] != nullptr && instances[0] != instances[1], "Step 1 threads shared a stateful allocator");
+        tu.expect(intact[0] && intact[1], "Step 2 objects of concurrent threads overlap");
+    });
+
     tu.run(argc, argv);
 
     return 0;